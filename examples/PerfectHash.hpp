@@ -0,0 +1,151 @@
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Compile-time perfect hash over the strings in one or more constexpr string
+// tables (std::array<const char*, N>).
+
+// Every distinct string gets a small id starting at 1, with 0 meaning "not
+// in any table", and a mask with bit 'i' set if it's in the i'th table. At
+// runtime a lookup is one hash of the text, two table reads and one memcmp.
+
+// The hash is built "hash and displace" style - strings are sorted into
+// buckets by their hash, and each bucket gets a displacement that moves all
+// its strings into empty slots. Big buckets are placed first, while most of
+// the slots are still empty.
+
+template<const auto&... tables>
+struct PerfectHash {
+  static constexpr size_t max_words = (tables.size() + ...);
+
+  static constexpr size_t slot_count = [] {
+    size_t n = 16;
+    while (n < max_words * 2) n *= 2;
+    return n;
+  }();
+
+  static constexpr size_t bucket_count = slot_count / 4;
+
+  //----------------------------------------
+
+  static constexpr uint64_t hash(const char* a, const char* b) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (; a < b; a++) h = (h ^ (unsigned char)*a) * 0x100000001b3ull;
+    return h;
+  }
+
+  static constexpr uint32_t slot(uint64_t h, uint32_t disp) {
+    uint64_t x = h ^ (disp * 0x9E3779B97F4A7C15ull);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return uint32_t(x & (slot_count - 1));
+  }
+
+  struct Table {
+    const char* words[max_words + 1] = {};
+    uint32_t    lens [max_words + 1] = {};
+    uint32_t    masks[max_words + 1] = {};
+    uint16_t    slots[slot_count] = {};
+    uint16_t    disps[bucket_count] = {};
+    uint32_t    max_len = 0;
+    int         count = 0;
+    bool        ok = true;
+  };
+
+  //----------------------------------------
+
+  template<typename array_type>
+  static constexpr void add_table(Table& t, const array_type& words, int index) {
+    for (const char* word : words) {
+      int id = 1;
+      while (id <= t.count && __builtin_strcmp(t.words[id], word) != 0) id++;
+      if (id > t.count) {
+        t.count = id;
+        t.words[id] = word;
+        t.lens[id] = uint32_t(__builtin_strlen(word));
+        if (t.lens[id] > t.max_len) t.max_len = t.lens[id];
+      }
+      t.masks[id] |= 1u << index;
+    }
+  }
+
+  static constexpr Table build() {
+    Table t;
+    int index = 0;
+    (add_table(t, tables, index++), ...);
+
+    uint64_t hashes[max_words + 1] = {};
+    int bucket_sizes[bucket_count] = {};
+    int max_bucket = 0;
+    for (int id = 1; id <= t.count; id++) {
+      hashes[id] = hash(t.words[id], t.words[id] + t.lens[id]);
+      int size = ++bucket_sizes[hashes[id] & (bucket_count - 1)];
+      if (size > max_bucket) max_bucket = size;
+    }
+
+    for (int size = max_bucket; size > 0; size--) {
+      for (uint32_t b = 0; b < bucket_count; b++) {
+        if (bucket_sizes[b] != size) continue;
+
+        bool placed = false;
+        for (uint32_t disp = 0; disp < 0xFFFF && !placed; disp++) {
+          placed = true;
+          for (int id = 1; id <= t.count && placed; id++) {
+            if ((hashes[id] & (bucket_count - 1)) != b) continue;
+            auto s = slot(hashes[id], disp);
+            if (t.slots[s]) placed = false;
+            else t.slots[s] = uint16_t(id);
+          }
+
+          // Didn't fit, take back the slots we filled.
+          if (!placed) {
+            for (auto& s : t.slots) {
+              if (s && (hashes[s] & (bucket_count - 1)) == b) s = 0;
+            }
+          } else {
+            t.disps[b] = uint16_t(disp);
+          }
+        }
+        if (!placed) t.ok = false;
+      }
+    }
+    return t;
+  }
+
+  static constexpr Table table = build();
+  static_assert(table.ok, "Couldn't find a perfect hash for these tables");
+
+  //----------------------------------------
+  // Returns the id of the string in [a, b), or 0 if it isn't in any table.
+
+  static int lookup(const char* a, const char* b) {
+    size_t len = b - a;
+    if (len == 0 || len > table.max_len) return 0;
+    uint64_t h = hash(a, b);
+    int id = table.slots[slot(h, table.disps[h & (bucket_count - 1)])];
+    if (table.lens[id] != len) return 0;
+    return __builtin_memcmp(table.words[id], a, len) == 0 ? id : 0;
+  }
+
+  // Compile-time version, for turning literals into ids.
+  static constexpr int id(const char* text) {
+    for (int id = 1; id <= table.count; id++) {
+      if (__builtin_strcmp(table.words[id], text) == 0) return id;
+    }
+    return 0;
+  }
+
+  static constexpr bool in_table(int id, int index) {
+    return table.masks[id] & (1u << index);
+  }
+
+  static constexpr const char* word(int id) { return table.words[id]; }
+};
+
+//------------------------------------------------------------------------------
@@ -3,23 +3,22 @@
 
 #pragma once
 
+#include <array>
 #include <stdio.h>
 
+#include "examples/PerfectHash.hpp"
+
 //------------------------------------------------------------------------------
-// Sorted string table matcher thing.
+// Static string table matcher thing. Lookups go through a perfect hash of the
+// table built at compile time, so they cost one hash of the text and one
+// memcmp no matter how big the table is. The table doesn't need to be sorted.
 
 template<const auto& table>
 struct SST;
 
 template<typename T, auto N, const std::array<T, N>& table>
 struct SST<table> {
-
-  constexpr static size_t top_bit(size_t x) {
-    for (size_t b = 31; b >= 0; b--) {
-      if (x & (1 << b)) return (1 << b);
-    }
-    return 0;
-  }
+  using hash = PerfectHash<table>;
 
   constexpr static bool contains(const char* text) {
     for (auto table_entry : table) {
@@ -38,34 +37,21 @@ struct SST<table> {
     }
   }
 
+  // Returns the table entry matching [a, b), or nullptr if there isn't one.
   static const char* match(const char* a, const char* b) {
     if (!a || *a == 0) return nullptr;
-    size_t bit = top_bit(N);
-    size_t index = 0;
 
-    // I'm not actually sure if 8 is the best tradeoff but it seems OK
-    if (N > 8) {
-      // Binary search for large tables
-      while(1) {
-        size_t new_index = index | bit;
-        if (new_index < N) {
-          auto lit = table[new_index];
-          auto c = strcmp_span(a, b, lit);
-          if (c == 0) return lit;
-          if (c > 0) index = new_index;
-        }
-        if (bit == 0) return nullptr;
-        bit >>= 1;
-      }
-    }
-    else {
-      // Linear scan for small tables
+    // Hashing costs more than a couple of compares, so tiny tables still get
+    // scanned.
+    if constexpr (N <= 4) {
       for (auto lit : table) {
         if (strcmp_span(a, b, lit) == 0) return lit;
       }
+      return nullptr;
+    }
+    else {
+      return hash::word(hash::lookup(a, b));
     }
-
-    return nullptr;
   }
 };
 
@@ -5,12 +5,15 @@
 
 #include "examples/c_lexer/CLexer.hpp"
 
-#include "examples/SST.hpp"
 #include "examples/c_lexer/CToken.hpp"
 #include "matcheroni/Matcheroni.hpp"
 #include "matcheroni/Utilities.hpp"
 #include "matcheroni/Cookbook.hpp"
 
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
 using namespace matcheroni;
 
 template <typename M>
@@ -18,6 +21,9 @@ using ticked = Seq<Opt<Atom<'\''>>, M>;
 
 // clang-format off
 CToken    next_lexeme      (TextMatchContext& ctx, TextSpan body);
+CToken    next_lexeme_table(TextMatchContext& ctx, TextSpan body);
+CToken    next_lexeme_fused(TextMatchContext& ctx, TextSpan body);
+CToken    next_lexeme_table_fused(TextMatchContext& ctx, TextSpan body);
 TextSpan  match_space      (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_newline    (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_string     (TextMatchContext& ctx, TextSpan body);
@@ -29,6 +35,7 @@ TextSpan  match_preproc    (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_float      (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_int        (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_punct      (TextMatchContext& ctx, TextSpan body);
+TextSpan  match_operator   (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_splice     (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_formfeed   (TextMatchContext& ctx, TextSpan body);
 TextSpan  match_eof        (TextMatchContext& ctx, TextSpan body);
@@ -42,14 +49,15 @@ void CLexer::reset() { tokens.clear(); }
 
 //------------------------------------------------------------------------------
 
-bool CLexer::lex(TextSpan text) {
+template <CToken (*next)(TextMatchContext&, TextSpan)>
+static bool lex_with(std::vector<CToken>& tokens, TextSpan text) {
   tokens.push_back(CToken(LEX_BOF, TextSpan(text.begin, text.begin)));
 
 
   TextMatchContext ctx;
   while (text.is_valid()) {
     // Don't pass begin context here or we will slow way down doing rewinds
-    auto token = next_lexeme(ctx, text);
+    auto token = next(ctx, text);
     tokens.push_back(token);
     if (token.type == LEX_INVALID) {
       return false;
@@ -61,39 +69,336 @@ bool CLexer::lex(TextSpan text) {
   return true;
 }
 
+bool CLexer::lex(TextSpan text) {
+  return fuse_ops ? lex_with<next_lexeme_fused>(tokens, text)
+                  : lex_with<next_lexeme>(tokens, text);
+}
+
+bool CLexer::lex_table(TextSpan text) {
+  return fuse_ops ? lex_with<next_lexeme_table_fused>(tokens, text)
+                  : lex_with<next_lexeme_table>(tokens, text);
+}
+
+CToken CLexer::next(TextMatchContext& ctx, TextSpan body) const {
+  return fuse_ops ? next_lexeme_fused(ctx, body) : next_lexeme(ctx, body);
+}
+
 //------------------------------------------------------------------------------
+// Lexes tokens starting at text.begin until the next token would start at or
+// after 'stop', so the last token may run past it. A null 'stop' lexes to the
+// end of the text.
 
-CToken next_lexeme(TextMatchContext& ctx, TextSpan body) {
-  TextSpan tail;
+static void lex_chunk(const CLexer* lexer, std::vector<CToken>& tokens,
+                      TextSpan text, const char* stop) {
+  TextMatchContext ctx;
+  while (!stop || text.begin < stop) {
+    auto token = lexer->next(ctx, text);
+    tokens.push_back(token);
+    if (token.type == LEX_INVALID || token.type == LEX_EOF) break;
+    text.begin = token.text.end;
+  }
+}
+
+bool CLexer::lex_parallel(TextSpan text, int thread_count, size_t min_chunk) {
+  size_t len = text.len();
+  size_t chunk_count = thread_count > 1 ? std::min(size_t(thread_count), len / min_chunk) : 1;
+  if (chunk_count < 2) return lex(text);
+
+  // Cut after the first newline past each even split point. Cuts that run
+  // into each other or off the end of the text are dropped.
+  std::vector<const char*> cuts = {text.begin};
+  for (size_t i = 1; i < chunk_count; i++) {
+    auto cut = std::max(text.begin + len * i / chunk_count, cuts.back());
+    cut = (const char*)memchr(cut, '\n', text.end - cut);
+    if (!cut || cut + 1 >= text.end) break;
+    cuts.push_back(cut + 1);
+  }
+  cuts.push_back(text.end);
+  chunk_count = cuts.size() - 1;
+  if (chunk_count < 2) return lex(text);
+
+  if (chunk_tokens.size() < chunk_count) chunk_tokens.resize(chunk_count);
+  for (auto& c : chunk_tokens) c.clear();
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < chunk_count; i++) {
+    auto stop = i + 1 < chunk_count ? cuts[i + 1] : nullptr;
+    threads.emplace_back(lex_chunk, this, std::ref(chunk_tokens[i]),
+                         TextSpan(cuts[i], text.end), stop);
+  }
+  lex_chunk(this, chunk_tokens[0], text, cuts[1]);
+  for (auto& t : threads) t.join();
 
-  if (auto tail = match_space(ctx, body)  ) return CToken(LEX_SPACE, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_newline(ctx, body)) return CToken(LEX_NEWLINE, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_string(ctx, body) ) return CToken(LEX_STRING, TextSpan(body.begin, tail.begin));
+  //----------------------------------------
+  // Lexing only depends on where we start, so once the real token stream and
+  // a chunk's tokens agree on a token boundary they agree on everything after
+  // it. 'pos' is always a real token boundary.
 
+  tokens.push_back(CToken(LEX_BOF, TextSpan(text.begin, text.begin)));
+
+  TextMatchContext ctx;
+  const char* pos = text.begin;
+
+  for (size_t i = 0; i < chunk_count; i++) {
+    auto& chunk = chunk_tokens[i];
+    bool last = i + 1 == chunk_count;
+    size_t k = 0;
+
+    while (last || pos < cuts[i + 1]) {
+      while (k < chunk.size() && chunk[k].text.begin < pos) k++;
+
+      if (k < chunk.size() && chunk[k].text.begin == pos) {
+        tokens.insert(tokens.end(), chunk.begin() + k, chunk.end());
+        pos = tokens.back().text.end;
+        break;
+      }
+
+      auto token = next(ctx, TextSpan(pos, text.end));
+      tokens.push_back(token);
+      if (token.type == LEX_INVALID || token.type == LEX_EOF) break;
+      pos = token.text.end;
+    }
+
+    if (tokens.back().type == LEX_INVALID) return false;
+    if (tokens.back().type == LEX_EOF) return true;
+  }
+
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
+// The lexer's match functions can't work out their own FIRST sets, so we
+// declare them here. These only have to include every character each kind of
+// lexeme can start with - including extras just costs time.
+
+using LexFunc = TextSpan (*)(TextMatchContext&, TextSpan);
+
+// clang-format off
+template <LexFunc punct>
+using lexeme = Switch<
+  FirstOf<Atom<' ', '\t'>,                Ref<match_space>>,
+  FirstOf<Atom<'\r', '\n'>,               Ref<match_newline>>,
+  FirstOf<Atom<'"', 'u', 'U', 'L', 'R'>,  Ref<match_string>>,
   // Match char needs to come before match identifier because of its possible
   // L'_' prefix...
-  if (auto tail = match_char(ctx, body)   ) return CToken(LEX_CHAR, TextSpan(body.begin, tail.begin));
-
-  if (auto tail = match_identifier(ctx, body)) {
-    auto text = TextSpan(body.begin, tail.begin);
-    if (SST<c_keywords>::match(text.begin, text.end)) {
-      return CToken(LEX_KEYWORD, text);
-    } else {
-      return CToken(LEX_IDENTIFIER, text);
+  FirstOf<Atom<'\'', 'u', 'U', 'L'>,      Ref<match_char>>,
+  FirstOf<Range<'a', 'z', 'A', 'Z', '_', '_', '$', '$', '\\', '\\', 128, 255>,
+                                          Ref<match_identifier>>,
+  FirstOf<Atom<'/'>,                      Ref<match_comment>>,
+  FirstOf<Atom<'#'>,                      Ref<match_preproc>>,
+  FirstOf<Range<'0', '9', '.', '.'>,      Ref<match_float>>,
+  FirstOf<Range<'0', '9'>,                Ref<match_int>>,
+  FirstOf<Charset<"-,;:!?.()[]{}*/&#%^+<=>|~">, Ref<punct>>,
+  FirstOf<Atom<'\\'>,                     Ref<match_splice>>,
+  FirstOf<Atom<'\f'>,                     Ref<match_formfeed>>,
+  FirstOf<Atom<'\0'>,                     Ref<match_eof>>
+>;
+
+constexpr LexemeType lexeme_types[] = {
+  LEX_SPACE,
+  LEX_NEWLINE,
+  LEX_STRING,
+  LEX_CHAR,
+  LEX_IDENTIFIER,
+  LEX_COMMENT,
+  LEX_PREPROC,
+  LEX_FLOAT,
+  LEX_INT,
+  LEX_PUNCT,
+  LEX_SPLICE,
+  LEX_FORMFEED,
+  LEX_EOF,
+};
+// clang-format on
+
+// Most punctuators are one character, those skip the hash lookup.
+struct SingleCharOps {
+  constexpr SingleCharOps() {
+    for (auto op : c_operators) {
+      if (op[1] == 0) ops[(unsigned char)op[0]] = uint8_t(c_ops::id(op));
     }
   }
 
-  if (auto tail = match_comment(ctx, body) ) return CToken(LEX_COMMENT, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_preproc(ctx, body) ) return CToken(LEX_PREPROC, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_float(ctx, body)   ) return CToken(LEX_FLOAT, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_int(ctx, body)     ) return CToken(LEX_INT, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_punct(ctx, body)   ) return CToken(LEX_PUNCT, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_splice(ctx, body)  ) return CToken(LEX_SPLICE, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_formfeed(ctx, body)) return CToken(LEX_FORMFEED, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_eof(ctx, body)     ) return CToken(LEX_EOF, TextSpan(body.begin, tail.begin));
-  if (auto tail = match_string(ctx, body)  ) return CToken(LEX_STRING, TextSpan(body.begin, tail.begin));
+  uint8_t ops[256] = {};
+};
+
+constexpr SingleCharOps single_char_ops;
+
+// Only fused operators get here, so keep the hash out of the hot path.
+__attribute__((noinline))
+static uint8_t lookup_op(TextSpan text) {
+  return uint8_t(c_ops::lookup(text.begin, text.end));
+}
+
+// Identifiers get their word id, and the ones in c_keywords become keywords.
+// Punctuators get their operator id.
+static inline CToken classify_word(CToken token) {
+  if (token.type == LEX_IDENTIFIER) {
+    token.word = uint16_t(c_words::lookup(token.text.begin, token.text.end));
+    if (token.in_words(WORD_KEYWORD)) token.type = LEX_KEYWORD;
+  } else if (token.type == LEX_PUNCT) {
+    token.op = token.text.len() == 1
+      ? single_char_ops.ops[(unsigned char)*token.text.begin]
+      : lookup_op(token.text);
+  }
+  return token;
+}
+
+template <LexFunc punct>
+static inline CToken next_lexeme_with(TextMatchContext& ctx, TextSpan body) {
+  int index;
+  auto tail = lexeme<punct>::match_index(ctx, body, index);
+  if (!tail.is_valid()) return CToken(LEX_INVALID, body.fail());
+
+  return classify_word(CToken(lexeme_types[index], TextSpan(body.begin, tail.begin)));
+}
+
+CToken next_lexeme(TextMatchContext& ctx, TextSpan body) {
+  return next_lexeme_with<match_punct>(ctx, body);
+}
+
+CToken next_lexeme_fused(TextMatchContext& ctx, TextSpan body) {
+  return next_lexeme_with<match_operator>(ctx, body);
+}
+
+//------------------------------------------------------------------------------
+// The table-driven lexer sorts every byte into the class of lexemes that can
+// start with it, and each class tries its candidates in the same order as the
+// Switch above - so both lexers produce the same tokens. Most classes only have
+// one candidate.
+
+enum LexClass : uint8_t {
+  LC_INVALID = 0,
+  LC_SPACE,       // ' ' '\t'
+  LC_NEWLINE,     // '\r' '\n'
+  LC_DQUOTE,      // '"'
+  LC_SQUOTE,      // '\''
+  LC_PREFIX,      // 'u' 'U' 'L' - string, char or identifier
+  LC_RAW,         // 'R' - raw string or identifier
+  LC_IDENT,
+  LC_BACKSLASH,   // universal character name or splice
+  LC_SLASH,       // comment or punct
+  LC_HASH,        // preproc
+  LC_DIGIT,       // float or int
+  LC_DOT,         // float or punct
+  LC_PUNCT,
+  LC_FORMFEED,
+  LC_NUL,
+};
+
+struct LexClassTable {
+  constexpr LexClassTable() {
+    for (int c = 'a'; c <= 'z'; c++) classes[c] = LC_IDENT;
+    for (int c = 'A'; c <= 'Z'; c++) classes[c] = LC_IDENT;
+    for (int c = 128; c <= 255; c++) classes[c] = LC_IDENT;
+    for (int c = '0'; c <= '9'; c++) classes[c] = LC_DIGIT;
+    for (auto c : "-,;:!?()[]{}*&%^+<=>|~") classes[(unsigned char)c] = LC_PUNCT;
+
+    classes['_']  = LC_IDENT;
+    classes['$']  = LC_IDENT;
+    classes['u']  = LC_PREFIX;
+    classes['U']  = LC_PREFIX;
+    classes['L']  = LC_PREFIX;
+    classes['R']  = LC_RAW;
+    classes[' ']  = LC_SPACE;
+    classes['\t'] = LC_SPACE;
+    classes['\r'] = LC_NEWLINE;
+    classes['\n'] = LC_NEWLINE;
+    classes['"']  = LC_DQUOTE;
+    classes['\''] = LC_SQUOTE;
+    classes['\\'] = LC_BACKSLASH;
+    classes['/']  = LC_SLASH;
+    classes['#']  = LC_HASH;
+    classes['.']  = LC_DOT;
+    classes['\f'] = LC_FORMFEED;
+    classes[0]    = LC_NUL;
+  }
+
+  uint8_t classes[256] = {};
+};
+
+constexpr LexClassTable lex_class_table;
+
+static inline bool try_lexeme(TextMatchContext& ctx, TextSpan body,
+                              LexFunc match, LexemeType type, CToken& token) {
+  auto tail = match(ctx, body);
+  if (!tail.is_valid()) return false;
+  token = CToken(type, TextSpan(body.begin, tail.begin));
+  return true;
+}
+
+template <LexFunc punct>
+static inline CToken next_lexeme_table_with(TextMatchContext& ctx, TextSpan body) {
+  if (body.is_empty()) return CToken(LEX_EOF, body);
+
+  CToken token(LEX_INVALID, body.fail());
+
+  switch (lex_class_table.classes[(unsigned char)*body.begin]) {
+    case LC_SPACE:
+      try_lexeme(ctx, body, match_space, LEX_SPACE, token);
+      break;
+    case LC_NEWLINE:
+      try_lexeme(ctx, body, match_newline, LEX_NEWLINE, token);
+      break;
+    case LC_DQUOTE:
+      try_lexeme(ctx, body, match_string, LEX_STRING, token);
+      break;
+    case LC_SQUOTE:
+      try_lexeme(ctx, body, match_char, LEX_CHAR, token);
+      break;
+    case LC_PREFIX:
+      try_lexeme(ctx, body, match_string, LEX_STRING, token) ||
+      try_lexeme(ctx, body, match_char, LEX_CHAR, token) ||
+      try_lexeme(ctx, body, match_identifier, LEX_IDENTIFIER, token);
+      break;
+    case LC_RAW:
+      try_lexeme(ctx, body, match_string, LEX_STRING, token) ||
+      try_lexeme(ctx, body, match_identifier, LEX_IDENTIFIER, token);
+      break;
+    case LC_IDENT:
+      try_lexeme(ctx, body, match_identifier, LEX_IDENTIFIER, token);
+      break;
+    case LC_BACKSLASH:
+      try_lexeme(ctx, body, match_identifier, LEX_IDENTIFIER, token) ||
+      try_lexeme(ctx, body, match_splice, LEX_SPLICE, token);
+      break;
+    case LC_SLASH:
+      try_lexeme(ctx, body, match_comment, LEX_COMMENT, token) ||
+      try_lexeme(ctx, body, punct, LEX_PUNCT, token);
+      break;
+    case LC_HASH:
+      // match_preproc() takes the rest of the line, so it can't fail here.
+      try_lexeme(ctx, body, match_preproc, LEX_PREPROC, token);
+      break;
+    case LC_DIGIT:
+      try_lexeme(ctx, body, match_float, LEX_FLOAT, token) ||
+      try_lexeme(ctx, body, match_int, LEX_INT, token);
+      break;
+    case LC_DOT:
+      try_lexeme(ctx, body, match_float, LEX_FLOAT, token) ||
+      try_lexeme(ctx, body, punct, LEX_PUNCT, token);
+      break;
+    case LC_PUNCT:
+      try_lexeme(ctx, body, punct, LEX_PUNCT, token);
+      break;
+    case LC_FORMFEED:
+      try_lexeme(ctx, body, match_formfeed, LEX_FORMFEED, token);
+      break;
+    case LC_NUL:
+      try_lexeme(ctx, body, match_eof, LEX_EOF, token);
+      break;
+  }
+
+  return classify_word(token);
+}
+
+CToken next_lexeme_table(TextMatchContext& ctx, TextSpan body) {
+  return next_lexeme_table_with<match_punct>(ctx, body);
+}
 
-  return CToken(LEX_INVALID, body.fail());
+CToken next_lexeme_table_fused(TextMatchContext& ctx, TextSpan body) {
+  return next_lexeme_table_with<match_operator>(ctx, body);
 }
 
 //------------------------------------------------------------------------------
@@ -131,12 +436,12 @@ TextSpan match_int(TextMatchContext& ctx, TextSpan body) {
 
   using decimal_constant     = Seq<nonzero_digit, Any<ticked<digit>>>;
 
-  using hexadecimal_prefix         = Oneof<Lit<"0x">, Lit<"0X">>;
+  using hexadecimal_prefix         = Lits<"0x", "0X">;
   using hexadecimal_digit          = Range<'0','9','a','f','A','F'>;
   using hexadecimal_digit_sequence = Seq<hexadecimal_digit, Any<ticked<hexadecimal_digit>>>;
   using hexadecimal_constant       = Seq<hexadecimal_prefix, hexadecimal_digit_sequence>;
 
-  using binary_prefix         = Oneof<Lit<"0b">, Lit<"0B">>;
+  using binary_prefix         = Lits<"0b", "0B">;
   using binary_digit          = Atom<'0','1'>;
   using binary_digit_sequence = Seq<binary_digit, Any<ticked<binary_digit>>>;
   using binary_constant       = Seq<binary_prefix, binary_digit_sequence>;
@@ -144,22 +449,15 @@ TextSpan match_int(TextMatchContext& ctx, TextSpan body) {
   using octal_digit        = Range<'0', '7'>;
   using octal_constant     = Seq<Atom<'0'>, Any<ticked<octal_digit>>>;
 
-  using unsigned_suffix        = Atom<'u', 'U'>;
-  using long_suffix            = Atom<'l', 'L'>;
-  using long_long_suffix       = Oneof<Lit<"ll">, Lit<"LL">>;
-  using bit_precise_int_suffix = Oneof<Lit<"wb">, Lit<"WB">>;
+  using unsigned_suffix = Atom<'u', 'U'>;
+
+  // long, long long, and _BitInt suffixes. Lits<> takes the longest match, so
+  // "ll" doesn't stop at "l".
+  using size_suffix = Lits<"l", "L", "ll", "LL", "wb", "WB">;
 
-  // This is begin little odd because we have to match in longest-suffix-first order
-  // to ensure we capture the entire suffix
   using integer_suffix = Oneof<
-    Seq<unsigned_suffix,  long_long_suffix>,
-    Seq<unsigned_suffix,  long_suffix>,
-    Seq<unsigned_suffix,  bit_precise_int_suffix>,
-    Seq<unsigned_suffix>,
-
-    Seq<long_long_suffix,       Opt<unsigned_suffix>>,
-    Seq<long_suffix,            Opt<unsigned_suffix>>,
-    Seq<bit_precise_int_suffix, Opt<unsigned_suffix>>
+    Seq<unsigned_suffix, Opt<size_suffix>>,
+    Seq<size_suffix,     Opt<unsigned_suffix>>
   >;
 
   // GCC allows i or j in addition to the normal suffixes for complex-ified types :/...
@@ -238,13 +536,15 @@ TextSpan match_identifier(TextMatchContext& ctx, TextSpan body) {
   // Not sure if this should be in here
   using latin1_ext = Range<128,255>;
 
+  // The single-character classes go first so they collapse into one table
+  // lookup.
   using nondigit = Oneof<
     Range<'a', 'z'>,
     Range<'A', 'Z'>,
     Atom<'_'>,
     Atom<'$'>,
-    Ref<match_universal_character_name>,
     latin1_ext, // One of the GCC test files requires this
+    Ref<match_universal_character_name>,
     Ref<match_utf8>  // Lots of GCC test files for unicode
   >;
 
@@ -259,11 +559,11 @@ TextSpan match_identifier(TextMatchContext& ctx, TextSpan body) {
 
 TextSpan match_float(TextMatchContext& ctx, TextSpan body) {
   // clang-format off
-  using floating_suffix = Oneof<
-    Atom<'f'>, Atom<'l'>, Atom<'F'>, Atom<'L'>,
+  using floating_suffix = Lits<
+    "f", "l", "F", "L",
     // Decimal floats, GCC thing
-    Lit<"df">, Lit<"dd">, Lit<"dl">,
-    Lit<"DF">, Lit<"DD">, Lit<"DL">
+    "df", "dd", "dl",
+    "DF", "DD", "DL"
   >;
 
   using digit = Range<'0', '9'>;
@@ -295,7 +595,7 @@ TextSpan match_float(TextMatchContext& ctx, TextSpan body) {
     Seq< digit_sequence, exponent_part,           Opt<complex_suffix>, Opt<floating_suffix>, Opt<complex_suffix> >
   >;
 
-  using hexadecimal_prefix         = Oneof<Lit<"0x">, Lit<"0X">>;
+  using hexadecimal_prefix         = Lits<"0x", "0X">;
 
   using hexadecimal_floating_constant = Seq<
     hexadecimal_prefix,
@@ -362,7 +662,7 @@ TextSpan match_char(TextMatchContext& ctx, TextSpan body) {
   using c_char             = Oneof<Ref<match_escape_sequence>, NotAtom<'\'', '\\', '\n'>>;
   //using c_char_sequence    = Some<c_char>;
 
-  using encoding_prefix    = Oneof<Lit<"u8">, Atom<'u', 'U', 'L'>>; // u8 must go first
+  using encoding_prefix    = Lits<"u8", "u", "U", "L">;
 
   // The spec disallows empty character constants, but...
   //using character_constant = Seq< Opt<encoding_prefix>, Atom<'\''>, c_char_sequence, Atom<'\''> >;
@@ -383,7 +683,7 @@ TextSpan match_cooked_string_literal(TextMatchContext& ctx, TextSpan body) {
   // clang-format off
   using s_char          = Oneof<Ref<match_splice>, Ref<match_escape_sequence>, NotAtom<'"', '\\', '\n'>>;
   using s_char_sequence = Some<s_char>;
-  using encoding_prefix = Oneof<Lit<"u8">, Atom<'u', 'U', 'L'>>; // u8 must go first
+  using encoding_prefix = Lits<"u8", "u", "U", "L">;
   using string_literal  = Seq<Opt<encoding_prefix>, Atom<'"'>, Opt<s_char_sequence>, Atom<'"'>>;
   // clang-format on
 
@@ -395,7 +695,7 @@ TextSpan match_cooked_string_literal(TextMatchContext& ctx, TextSpan body) {
 
 TextSpan match_raw_string_literal(TextMatchContext& ctx, TextSpan body) {
   // clang-format off
-  using encoding_prefix    = Oneof<Lit<"u8">, Atom<'u', 'U', 'L'>>; // u8 must go first
+  using encoding_prefix    = Lits<"u8", "u", "U", "L">;
 
   // We ignore backslash in d_char for similar splice-related reasons
   //using d_char          = NotAtom<' ', '(', ')', '\\', '\t', '\v', '\f', '\n'>;
@@ -452,6 +752,20 @@ TextSpan match_punct(TextMatchContext& ctx, TextSpan body) {
   return punctuator::match(ctx, body);
 }
 
+// Maximal munch over everything in c_operators.
+TextSpan match_operator(TextMatchContext& ctx, TextSpan body) {
+  // clang-format off
+  using pattern = Lits<
+    "...", "<<=", ">>=", "->*", "<=>",
+    "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+    "*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=", "::", ".*", "##",
+    "-", ",", ";", ":", "!", "?", ".", "(", ")", "[", "]", "{", "}",
+    "*", "/", "&", "#", "%", "^", "+", "<", "=", ">", "|", "~"
+  >;
+  // clang-format on
+  return pattern::match(ctx, body);
+}
+
 // Yeaaaah, not gonna try to support trigraphs, they're obsolete and have been
 // removed from the latest C spec. Also we have to declare them funny to get
 // them through the preprocessor...
@@ -15,9 +15,34 @@ struct CLexer {
   void reset();
   bool lex(matcheroni::TextSpan text);
 
+  // Same tokens as lex(), but picks the candidate matchers for each lexeme
+  // from a table indexed by its first byte.
+  bool lex_table(matcheroni::TextSpan text);
+
+  // Same tokens as lex(), but splits the text into one chunk per thread at
+  // line breaks and lexes the chunks in parallel. A chunk that started in the
+  // middle of a comment, string, etc. gets re-lexed from where the previous
+  // chunk actually ended until it lines back up with its own tokens. Text
+  // shorter than min_chunk per thread is lexed serially.
+  bool lex_parallel(matcheroni::TextSpan text, int thread_count,
+                    size_t min_chunk = 65536);
+
+  // Lexes one token with whichever lexer fuse_ops picks.
+  CToken next(matcheroni::TextMatchContext& ctx, matcheroni::TextSpan body) const;
+
+  // Lex multi-character operators like "<<=" as one token instead of one token
+  // per character. The parser needs CContext::fused_ops set to match.
+  bool fuse_ops = false;
+
   std::vector<CToken> tokens;
+
+  // The speculative tokens for each chunk, kept around to reuse their memory.
+  std::vector<std::vector<CToken>> chunk_tokens;
 };
 
 CToken next_lexeme(matcheroni::TextMatchContext& ctx, matcheroni::TextSpan body);
+CToken next_lexeme_table(matcheroni::TextMatchContext& ctx, matcheroni::TextSpan body);
+CToken next_lexeme_fused(matcheroni::TextMatchContext& ctx, matcheroni::TextSpan body);
+CToken next_lexeme_table_fused(matcheroni::TextMatchContext& ctx, matcheroni::TextSpan body);
 
 //------------------------------------------------------------------------------
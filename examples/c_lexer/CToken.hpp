@@ -4,6 +4,7 @@
 #pragma once
 #include <stdint.h>
 
+#include "examples/PerfectHash.hpp"
 #include "examples/c_parser/c_constants.hpp"
 #include "matcheroni/Matcheroni.hpp"
 #include "matcheroni/Utilities.hpp"
@@ -30,6 +31,94 @@ enum LexemeType {
   LEX_LAST
 };
 
+//------------------------------------------------------------------------------
+// The lexer looks up every identifier in the word tables from c_constants.hpp
+// once, so the parser can check which tables a token is in with an integer
+// compare instead of a string search.
+
+enum CWordTable {
+  WORD_KEYWORD = 0,
+  WORD_TYPE_BASE,
+  WORD_TYPE_PREFIX,
+  WORD_TYPE_SUFFIX,
+  WORD_QUALIFIER,
+};
+
+using c_words = PerfectHash<
+  c_keywords,
+  builtin_type_base,
+  builtin_type_prefix,
+  builtin_type_suffix,
+  qualifiers
+>;
+
+//------------------------------------------------------------------------------
+// Punctuators get an operator id from c_operators. Normally each punctuator
+// character is its own token, but with CLexer::fuse_ops set the lexer makes
+// maximal-munch tokens like "<<=" and the parser can match them with one
+// compare.
+
+using c_ops = PerfectHash<c_operators>;
+
+enum COperator : uint8_t {
+  OP_NONE = 0,
+
+  OP_ELLIPSIS     = c_ops::id("..."),
+  OP_SHL_ASSIGN   = c_ops::id("<<="),
+  OP_SHR_ASSIGN   = c_ops::id(">>="),
+  OP_ARROW_STAR   = c_ops::id("->*"),
+  OP_SPACESHIP    = c_ops::id("<=>"),
+
+  OP_ARROW        = c_ops::id("->"),
+  OP_INC          = c_ops::id("++"),
+  OP_DEC          = c_ops::id("--"),
+  OP_SHL          = c_ops::id("<<"),
+  OP_SHR          = c_ops::id(">>"),
+  OP_LE           = c_ops::id("<="),
+  OP_GE           = c_ops::id(">="),
+  OP_EQ           = c_ops::id("=="),
+  OP_NE           = c_ops::id("!="),
+  OP_AND          = c_ops::id("&&"),
+  OP_OR           = c_ops::id("||"),
+  OP_MUL_ASSIGN   = c_ops::id("*="),
+  OP_DIV_ASSIGN   = c_ops::id("/="),
+  OP_MOD_ASSIGN   = c_ops::id("%="),
+  OP_ADD_ASSIGN   = c_ops::id("+="),
+  OP_SUB_ASSIGN   = c_ops::id("-="),
+  OP_AND_ASSIGN   = c_ops::id("&="),
+  OP_XOR_ASSIGN   = c_ops::id("^="),
+  OP_OR_ASSIGN    = c_ops::id("|="),
+  OP_SCOPE        = c_ops::id("::"),
+  OP_DOT_STAR     = c_ops::id(".*"),
+  OP_PASTE        = c_ops::id("##"),
+
+  OP_MINUS        = c_ops::id("-"),
+  OP_COMMA        = c_ops::id(","),
+  OP_SEMICOLON    = c_ops::id(";"),
+  OP_COLON        = c_ops::id(":"),
+  OP_BANG         = c_ops::id("!"),
+  OP_QUESTION     = c_ops::id("?"),
+  OP_DOT          = c_ops::id("."),
+  OP_LPAREN       = c_ops::id("("),
+  OP_RPAREN       = c_ops::id(")"),
+  OP_LBRACKET     = c_ops::id("["),
+  OP_RBRACKET     = c_ops::id("]"),
+  OP_LBRACE       = c_ops::id("{"),
+  OP_RBRACE       = c_ops::id("}"),
+  OP_STAR         = c_ops::id("*"),
+  OP_SLASH        = c_ops::id("/"),
+  OP_AMP          = c_ops::id("&"),
+  OP_HASH         = c_ops::id("#"),
+  OP_PERCENT      = c_ops::id("%"),
+  OP_CARET        = c_ops::id("^"),
+  OP_PLUS         = c_ops::id("+"),
+  OP_LT           = c_ops::id("<"),
+  OP_ASSIGN       = c_ops::id("="),
+  OP_GT           = c_ops::id(">"),
+  OP_PIPE         = c_ops::id("|"),
+  OP_TILDE        = c_ops::id("~"),
+};
+
 //------------------------------------------------------------------------------
 
 struct CToken {
@@ -45,9 +134,13 @@ struct CToken {
   uint32_t type_to_color() const;
   void dump() const;
 
+  bool in_words(CWordTable table) const { return c_words::in_table(word, table); }
+
   //----------------------------------------
 
   LexemeType type;
+  uint16_t word = 0;  // Id in c_words, or 0 if this isn't an identifier in it
+  uint8_t  op = 0;    // COperator, or OP_NONE if this isn't a punctuator
   matcheroni::TextSpan text;
 };
 
@@ -13,10 +13,14 @@
 #include <stdlib.h>    // for exit
 #include <string.h>    // for memset
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace matcheroni;
 
+// Comment this out to load files with utils::read() instead of mapping them.
+#define USE_MMAP
+
 //------------------------------------------------------------------------------
 
 std::vector<std::string> negative_test_cases = {
@@ -94,10 +98,24 @@ std::vector<std::string> negative_test_cases = {
 
 //------------------------------------------------------------------------------
 
+bool same_tokens(const std::vector<CToken>& a, const std::vector<CToken>& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].type != b[i].type) return false;
+    if (a[i].text.begin != b[i].text.begin) return false;
+    if (a[i].text.end != b[i].text.end) return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char** argv) {
   printf("Matcheroni C Lexer Benchmark\n");
 
   const char* base_path = argc > 1 ? argv[1] : ".";
+  int thread_count = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+  if (thread_count < 1) thread_count = 1;
 
   auto time_a = utils::timestamp_ms();
 
@@ -142,8 +160,13 @@ int main(int argc, char** argv) {
       continue;
     }
 
+#ifdef USE_MMAP
+    utils::MappedFile file(path.c_str());
+    std::string_view text(file.data, file.size);
+#else
     std::string text;
     utils::read(path.c_str(), text);
+#endif
 
     // Filter out all the files that are actually assembly
     // We split the string constants so we don't mark _this_ source file as
@@ -168,32 +191,80 @@ int main(int argc, char** argv) {
   // Lex all the good files
 
   CLexer lexer;
+  CLexer table_lexer;
+#ifdef USE_MMAP
+  utils::MappedFile file;
+#else
   std::string text;
+#endif
   size_t total_bytes = 0;
   double lex_msec = 0;
+  double table_msec = 0;
+  size_t mismatched_files = 0;
   bool any_fail = false;
   int count = 0;
 
+  // All the good files glued together, like an amalgamated library.
+  std::string amalgamation;
+
   printf("\n");
   printf("Lexing %ld source files in %s\n", source_files.size(), base_path);
   for (const auto& path : source_files) {
-    text.clear();
     lexer.reset();
+    table_lexer.reset();
 
     //printf("%05d: Lexing %s\n", count++, path.c_str());
 
+#ifdef USE_MMAP
+    file.open(path.c_str());
+    TextSpan text_span = file.span();
+#else
+    text.clear();
     utils::read(path.c_str(), text);
-    total_bytes += text.size();
+    TextSpan text_span = utils::to_span(text);
+#endif
+    total_bytes += text_span.len();
 
     lex_msec -= utils::timestamp_ms();
-    bool lex_ok = lexer.lex(utils::to_span(text));
+    bool lex_ok = lexer.lex(text_span);
     lex_msec += utils::timestamp_ms();
     if (!lex_ok) {
       failed_files.push_back(path);
       printf("Lexing failed for file %s:\n", path.c_str());
     }
+
+    // The table-driven lexer has to produce exactly the same tokens.
+    table_msec -= utils::timestamp_ms();
+    bool table_ok = table_lexer.lex_table(text_span);
+    table_msec += utils::timestamp_ms();
+
+    if (table_ok != lex_ok || !same_tokens(lexer.tokens, table_lexer.tokens)) {
+      mismatched_files++;
+      printf("Table lexer mismatch for file %s\n", path.c_str());
+    }
+
+    amalgamation.append(text_span.begin, text_span.end);
+    amalgamation.push_back('\n');
   }
 
+  //----------------------------------------
+  // Lex the amalgamation serially and in parallel.
+
+  TextSpan amalgamation_span = utils::to_span(amalgamation);
+
+  CLexer serial_lexer;
+  double serial_msec = -utils::wallclock_ms();
+  bool serial_ok = serial_lexer.lex(amalgamation_span);
+  serial_msec += utils::wallclock_ms();
+
+  CLexer parallel_lexer;
+  double parallel_msec = -utils::wallclock_ms();
+  bool parallel_ok = parallel_lexer.lex_parallel(amalgamation_span, thread_count);
+  parallel_msec += utils::wallclock_ms();
+
+  bool parallel_mismatch =
+    serial_ok != parallel_ok || !same_tokens(serial_lexer.tokens, parallel_lexer.tokens);
+
   //----------------------------------------
   // Report stats
 
@@ -201,6 +272,7 @@ int main(int argc, char** argv) {
   auto total_time = time_b - time_a;
 
   auto lex_sec = lex_msec / 1000;
+  auto table_sec = table_msec / 1000;
 
   printf("\n");
   printf("Total time  %f msec\n", total_time);
@@ -211,12 +283,23 @@ int main(int argc, char** argv) {
   printf("File rate   %.2f Kfiles/sec\n",  (source_files.size() / 1e3) / lex_sec);
   printf("Line rate   %.2f Mlines/sec\n",  (total_lines / 1e6) / lex_sec);
   printf("Byte rate   %.2f MBytes/sec\n",  (total_bytes / 1e6) / lex_sec);
+  printf("\n");
+  printf("Table lex time  %f msec\n", table_msec);
+  printf("Table byte rate %.2f MBytes/sec\n", (total_bytes / 1e6) / table_sec);
+  printf("Table mismatches      %ld\n", mismatched_files);
+  printf("\n");
+  printf("Amalgamation bytes    %ld\n", amalgamation.size());
+  printf("Serial lex time       %f msec\n", serial_msec);
+  printf("Parallel lex time     %f msec (%d threads)\n", parallel_msec, thread_count);
+  printf("Parallel speedup      %.2fx\n", serial_msec / parallel_msec);
+  printf("Parallel mismatch     %s\n", parallel_mismatch ? "YES" : "no");
+  printf("\n");
   printf("Total failures        %ld\n", failed_files.size());
   printf("Total known-bad files %ld\n", bad_files.size());
   printf("Total skipped files   %ld\n", skipped_files.size());
   printf("\n");
 
-  return failed_files.size() ? -1 : 0;
+  return failed_files.size() || mismatched_files || parallel_mismatch ? -1 : 0;
 }
 
 //------------------------------------------------------------------------------
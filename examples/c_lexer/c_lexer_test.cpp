@@ -5,6 +5,10 @@
 
 #include "examples/c_lexer/CLexer.hpp"
 
+#include <assert.h>
+#include <string>
+#include <vector>
+
 using namespace matcheroni;
 
 //------------------------------------------------------------------------------
@@ -41,7 +45,134 @@ int main(int argc, char** argv) {
 }
 )";
 
+//------------------------------------------------------------------------------
+// Chunks that start inside comments, strings and raw strings have to be
+// re-lexed from the end of the previous chunk.
+
+const char* chunky_text =
+R"text(
+/* A comment
+   that spans
+   a few lines */
+const char* a = "string \
+continued";
+const char* b = R"delim(
+a raw string
+)" with a fake end
+)delim";
+#define FOO(x) \
+  x + 1
+int c = 'x';
+)text";
+
+void test_lex_parallel() {
+  std::string raw_text;
+  for (int i = 0; i < 10; i++) raw_text += chunky_text;
+  auto span = utils::to_span(raw_text);
+
+  CLexer serial;
+  bool ok = serial.lex(span);
+  assert(ok);
+
+  for (int threads = 2; threads <= 16; threads++) {
+    CLexer parallel;
+    ok = parallel.lex_parallel(span, threads, 1);
+    assert(ok);
+    assert(parallel.tokens.size() == serial.tokens.size());
+    for (size_t i = 0; i < serial.tokens.size(); i++) {
+      assert(parallel.tokens[i].type == serial.tokens[i].type);
+      assert(parallel.tokens[i].text.begin == serial.tokens[i].text.begin);
+      assert(parallel.tokens[i].text.end == serial.tokens[i].text.end);
+    }
+  }
+
+  printf("test_lex_parallel() pass\n");
+}
+
+//------------------------------------------------------------------------------
+
+void test_fuse_ops() {
+  std::string raw_text = "a<<=b->c...d>>e|=f<=g";
+  auto span = utils::to_span(raw_text);
+
+  const uint8_t expected[] = {
+    OP_SHL_ASSIGN, OP_ARROW, OP_ELLIPSIS, OP_SHR, OP_OR_ASSIGN, OP_LE,
+  };
+
+  CLexer lexer;
+  lexer.fuse_ops = true;
+  bool ok = lexer.lex(span);
+  assert(ok);
+
+  size_t i = 0;
+  for (auto& t : lexer.tokens) {
+    if (t.type != LEX_PUNCT) continue;
+    assert(i < sizeof(expected));
+    assert(t.op == expected[i]);
+    i++;
+  }
+  assert(i == sizeof(expected));
+
+  // Split mode still hands out one character per token, each with its own id.
+  CLexer split;
+  ok = split.lex(span);
+  assert(ok);
+  for (auto& t : split.tokens) {
+    if (t.type == LEX_PUNCT) assert(t.text.len() == 1 && t.op != OP_NONE);
+  }
+
+  printf("test_fuse_ops() pass\n");
+}
+
+//------------------------------------------------------------------------------
+// The table-driven lexer has to produce exactly the same tokens as lex(). Run
+// both over some of our own sources, which cover most of the C lexicon.
+
+void test_lex_table() {
+  const char* paths[] = {
+    "examples/c_lexer/CLexer.cpp",
+    "examples/c_parser/c_parse_nodes.hpp",
+    "examples/c_parser/c_constants.hpp",
+    "matcheroni/Matcheroni.hpp",
+    "matcheroni/Parseroni.hpp",
+  };
+
+  std::vector<std::string> sources = {chunky_text};
+  for (auto path : paths) {
+    sources.push_back({});
+    utils::read(path, sources.back());
+    assert(!sources.back().empty() && "run from the repo root");
+  }
+
+  for (auto& source : sources) {
+    auto span = utils::to_span(source);
+
+    CLexer lexer;
+    bool ok = lexer.lex(span);
+    assert(ok);
+
+    CLexer table;
+    ok = table.lex_table(span);
+    assert(ok);
+
+    assert(table.tokens.size() == lexer.tokens.size());
+    for (size_t i = 0; i < lexer.tokens.size(); i++) {
+      assert(table.tokens[i].type == lexer.tokens[i].type);
+      assert(table.tokens[i].text.begin == lexer.tokens[i].text.begin);
+      assert(table.tokens[i].text.end == lexer.tokens[i].text.end);
+    }
+  }
+
+  printf("test_lex_table() pass\n");
+}
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char** argv) {
+  test_lex_parallel();
+  test_fuse_ops();
+  test_lex_table();
+
 
   std::string raw_text = some_text;
   raw_text.push_back(0);
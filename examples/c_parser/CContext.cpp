@@ -10,18 +10,16 @@ using namespace matcheroni;
 //------------------------------------------------------------------------------
 
 CContext::CContext() {
-  type_scope = new CScope();
   tokens.reserve(65536);
 }
 
 //------------------------------------------------------------------------------
 
 void CContext::reset() {
-  NodeContext::reset();
+  MemoContext::reset();
 
   tokens.clear();
-  while (type_scope->parent) pop_scope();
-  type_scope->clear();
+  type_scope.clear();
 }
 
 //------------------------------------------------------------------------------
@@ -42,6 +40,7 @@ bool CContext::parse(matcheroni::TextSpan text, TokenSpan lexemes) {
   TokenSpan body(tok_a, tok_b);
 
   auto tail = NodeTranslationUnit::match(*this, body);
+  parse_complete = tail.is_valid() && tail.is_empty();
   return tail.is_valid();
 }
 
@@ -67,77 +66,150 @@ bool CContext::parse(std::vector<CToken>& lexemes) {
 //------------------------------------------------------------------------------
 
 TokenSpan CContext::match_class_type(TokenSpan body) {
-  return type_scope->has_class_type(*this, body) ? body.advance(1) : body.fail();
+  return type_scope.has_class_type(*this, body) ? body.advance(1) : body.fail();
 }
 
 TokenSpan CContext::match_struct_type(TokenSpan body) {
-  return type_scope->has_struct_type(*this, body) ? body.advance(1) : body.fail();
+  return type_scope.has_struct_type(*this, body) ? body.advance(1) : body.fail();
 }
 
 TokenSpan CContext::match_union_type(TokenSpan body) {
-  return type_scope->has_union_type(*this, body) ? body.advance(1) : body.fail();
+  return type_scope.has_union_type(*this, body) ? body.advance(1) : body.fail();
 }
 
 TokenSpan CContext::match_enum_type(TokenSpan body) {
-  return type_scope->has_enum_type(*this, body) ? body.advance(1) : body.fail();
+  return type_scope.has_enum_type(*this, body) ? body.advance(1) : body.fail();
 }
 
 TokenSpan CContext::match_typedef_type(TokenSpan body) {
-  return type_scope->has_typedef_type(*this, body) ? body.advance(1) : body.fail();
+  return type_scope.has_typedef_type(*this, body) ? body.advance(1) : body.fail();
 }
 
-void CContext::add_class_type  (const CToken* a) { type_scope->add_class_type(*this, a); }
-void CContext::add_struct_type (const CToken* a) { type_scope->add_struct_type(*this, a); }
-void CContext::add_union_type  (const CToken* a) { type_scope->add_union_type(*this, a); }
-void CContext::add_enum_type   (const CToken* a) { type_scope->add_enum_type(*this, a); }
-void CContext::add_typedef_type(const CToken* a) { type_scope->add_typedef_type(*this, a); }
+// Whether an identifier names a type changes how things parse, so anything
+// that changes the set of visible types invalidates the memo table.
+
+void CContext::add_class_type  (const CToken* a) { memo.invalidate(); type_scope.add_class_type(*this, a); }
+void CContext::add_struct_type (const CToken* a) { memo.invalidate(); type_scope.add_struct_type(*this, a); }
+void CContext::add_union_type  (const CToken* a) { memo.invalidate(); type_scope.add_union_type(*this, a); }
+void CContext::add_enum_type   (const CToken* a) { memo.invalidate(); type_scope.add_enum_type(*this, a); }
+void CContext::add_typedef_type(const CToken* a) { memo.invalidate(); type_scope.add_typedef_type(*this, a); }
+void CContext::add_typedef_type(const char* t)   { memo.invalidate(); type_scope.add_typedef_type(t); }
 
 //----------------------------------------------------------------------------
+// Pushing an empty scope doesn't change which types are visible, popping a
+// scope only does if something was added to it.
 
-void CContext::push_scope() {
-  CScope* new_scope = new CScope();
-  new_scope->parent = type_scope;
-  type_scope = new_scope;
-}
+void CContext::push_scope() { type_scope.push(); }
 
 void CContext::pop_scope() {
-  CScope* old_scope = type_scope->parent;
-  if (old_scope) {
-    delete type_scope;
-    type_scope = old_scope;
-  }
+  if (type_scope.pop()) memo.invalidate();
 }
 
 //----------------------------------------------------------------------------
+// Braces are always tokens of their own, so skipping a body is just counting
+// them.
 
-TokenSpan CContext::match_builtin_type_base(TokenSpan body) {
+TokenSpan CContext::match_deferred_body(TokenSpan body) {
   if (!body.is_valid() || body.is_empty()) return body.fail();
-  if (SST<builtin_type_base>::match(body.begin->text.begin, body.begin->text.end)) {
-    return body.advance(1);
+  touch(body.begin);
+  if (body.begin->type != LEX_PUNCT || *body.begin->text.begin != '{') return body.fail();
+
+  int depth = 1;
+  for (auto t = body.begin + 1; t < body.end; t++) {
+    touch(t);
+    if (t->type != LEX_PUNCT) continue;
+    if (*t->text.begin == '{') {
+      depth++;
+    } else if (*t->text.begin == '}') {
+      if (--depth) continue;
+
+      auto tail = TokenSpan(t + 1, body.end);
+      auto node = create_node<CDeferredNode, "func_body">(TokenSpan(body.begin, tail.begin),
+                                                          CNode::DEFERRED, top_tail);
+      node->type_mark = type_scope.type_count();
+      return tail;
+    }
+  }
+  return body.fail();
+}
+
+// The body gets parsed as its own little tree and then moved under the
+// deferred node. Types added after the body are taken out of scope while it
+// parses and put back afterwards.
+
+bool CContext::expand(CNode* node) {
+  if (!node->is_deferred()) return true;
+  if (node->expand_failed()) return false;
+  auto deferred = (CDeferredNode*)node;
+  auto mark = deferred->type_mark;
+
+  std::vector<std::pair<TextSpan, CScope::TypeKind>> later_types;
+  for (auto i = mark; i < type_scope.type_count(); i++) {
+    later_types.push_back({type_scope.type_name(i), type_scope.type_kind(i)});
   }
-  else {
-    return body.fail();
+  if (type_scope.rewind(mark)) memo.invalidate();
+
+  auto old_head = top_head;
+  auto old_tail = top_tail;
+  auto old_lazy = lazy_bodies;
+  top_head = nullptr;
+  top_tail = nullptr;
+  lazy_bodies = false;
+  auto bookmark = checkpoint();
+
+  auto tail = NodeStatementCompound::match(*this, node->span);
+  bool ok = tail.is_valid() && tail.is_empty();
+  if (ok) {
+    node->child_head = top_head;
+    node->child_tail = top_tail;
+    for (auto c = top_head; c; c = c->node_next) c->node_parent = node;
+    node->flags &= ~CNode::DEFERRED;
+  } else {
+    rewind(bookmark);
+    node->flags |= CNode::EXPAND_FAILED;
   }
+
+  top_head = old_head;
+  top_tail = old_tail;
+  lazy_bodies = old_lazy;
+
+  for (auto& t : later_types) type_scope.add_type(t.first, t.second);
+  if (!later_types.empty()) memo.invalidate();
+  return ok;
+}
+
+static bool expand_tree(CContext& ctx, CNode* node) {
+  bool ok = ctx.expand(node);
+  for (auto c = node->child_head; c; c = c->node_next) ok &= expand_tree(ctx, c);
+  return ok;
+}
+
+bool CContext::expand_all() {
+  bool ok = true;
+  for (auto node = top_head; node; node = node->node_next) ok &= expand_tree(*this, node);
+  return ok;
+}
+
+//----------------------------------------------------------------------------
+
+// The lexer already looked these up, see CToken::word.
+
+TokenSpan CContext::match_builtin_type_base(TokenSpan body) {
+  if (!body.is_valid() || body.is_empty()) return body.fail();
+  touch(body.begin);
+  return body.begin->in_words(WORD_TYPE_BASE) ? body.advance(1) : body.fail();
 }
 
 TokenSpan CContext::match_builtin_type_prefix(TokenSpan body) {
   if (!body.is_valid() || body.is_empty()) return body.fail();
-  if (SST<builtin_type_prefix>::match(body.begin->text.begin, body.begin->text.end)) {
-    return body.advance(1);
-  }
-  else {
-    return body.fail();
-  }
+  touch(body.begin);
+  return body.begin->in_words(WORD_TYPE_PREFIX) ? body.advance(1) : body.fail();
 }
 
 TokenSpan CContext::match_builtin_type_suffix(TokenSpan body) {
   if (!body.is_valid() || body.is_empty()) return body.fail();
-  if (SST<builtin_type_suffix>::match(body.begin->text.begin, body.begin->text.end)) {
-    return body.advance(1);
-  }
-  else {
-    return body.fail();
-  }
+  touch(body.begin);
+  return body.begin->in_words(WORD_TYPE_SUFFIX) ? body.advance(1) : body.fail();
 }
 
 //------------------------------------------------------------------------------
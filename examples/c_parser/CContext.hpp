@@ -17,7 +17,6 @@
 #include "examples/c_lexer/CLexer.hpp"
 #include "examples/c_parser/CNode.hpp"
 #include "examples/c_parser/CScope.hpp"
-#include "examples/SST.hpp"
 
 struct CToken;
 struct CNode;
@@ -27,8 +26,12 @@ struct CScope;
 using TokenSpan = matcheroni::Span<CToken>;
 
 //------------------------------------------------------------------------------
+// CNodes have nothing to destroy, which lets failed matches throw away their
+// nodes by resetting the allocator instead of freeing them one at a time.
 
-class CContext : public parseroni::NodeContext<CNode> {
+static_assert(std::is_trivially_destructible_v<CDeferredNode>);
+
+class CContext : public parseroni::MemoContext<parseroni::NodeContext<CNode, true, false>> {
  public:
 
   using AtomType = CToken;
@@ -41,19 +44,29 @@ class CContext : public parseroni::NodeContext<CNode> {
     return (unsigned char)a - b;
   }
 
-  static int atom_cmp(const CToken& a, const LexemeType& b) {
+  // Token comparisons also record how far ahead the parser has looked, see
+  // 'horizon' below.
+
+  int atom_cmp(const CToken& a, const LexemeType& b) {
+    touch(&a);
     return a.type - b;
   }
 
-  static int atom_cmp(const CToken& a, const char& b) {
+  int atom_cmp(const CToken& a, const char& b) {
+    touch(&a);
     if (auto d = a.text.len() - 1) return d;
     return a.text.begin[0] - b;
   }
 
-  static int atom_cmp(const CToken& a, const matcheroni::TextSpan& b) {
+  int atom_cmp(const CToken& a, const matcheroni::TextSpan& b) {
+    touch(&a);
     return strcmp_span(a.text, b);
   }
 
+  void touch(const CToken* t) {
+    if (t > horizon) horizon = t;
+  }
+
   void reset();
   //bool parse(std::vector<CToken>& lexemes);
   bool parse(matcheroni::TextSpan text, TokenSpan lexemes);
@@ -73,10 +86,25 @@ class CContext : public parseroni::NodeContext<CNode> {
   void add_union_type  (const CToken* a);
   void add_enum_type   (const CToken* a);
   void add_typedef_type(const CToken* a);
+  void add_typedef_type(const char* t);
 
   void push_scope();
   void pop_scope();
 
+  // With lazy_bodies set, function bodies are skipped by brace matching and
+  // left as deferred nodes. expand() parses one of them in place, first_child()
+  // expands a node before descending into it. A body that doesn't parse is
+  // flagged with CNode::EXPAND_FAILED and left without children - check
+  // expand_failed() to tell it apart from an empty body. expand_all() returns
+  // false if any body failed.
+  TokenSpan match_deferred_body(TokenSpan body);
+  bool expand(CNode* node);
+  bool expand_all();
+  CNode* first_child(CNode* node) {
+    if (node->is_deferred()) expand(node);
+    return node->child_head;
+  }
+
   void append_node(CNode* node);
   void enclose_nodes(CNode* start, CNode* node);
 
@@ -92,7 +120,21 @@ class CContext : public parseroni::NodeContext<CNode> {
   TokenSpan  lexemes;
 
   std::vector<CToken> tokens;
-  CScope* type_scope;
+  CScope type_scope;
+  bool lazy_bodies = false;
+
+  // parse() succeeds as long as the translation unit matches, which it does
+  // even if it stops partway. This is only set if it used up every token.
+  bool parse_complete = false;
+
+  // Set if the tokens came from a CLexer with fuse_ops set.
+  bool fused_ops = false;
+
+  // The furthest token any matcher has examined, including ones that failed.
+  // A match's result can depend on everything up to here, not just on the
+  // tokens it consumed. Matchers that read tokens without going through
+  // atom_cmp() call touch() themselves.
+  const CToken* horizon = nullptr;
 };
 
 //------------------------------------------------------------------------------
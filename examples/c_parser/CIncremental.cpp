@@ -0,0 +1,352 @@
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+#include "examples/c_parser/CIncremental.hpp"
+
+#include "examples/c_parser/c_parse_nodes.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+using namespace matcheroni;
+
+//------------------------------------------------------------------------------
+
+static void shift_spans(CNode* node, ptrdiff_t shift) {
+  node->span = TokenSpan(node->span.begin + shift, node->span.end + shift);
+  for (auto c = node->child_head; c; c = c->node_next) shift_spans(c, shift);
+}
+
+static size_t first_token_at(const std::vector<CToken>& tokens, size_t begin,
+                             const char* pos) {
+  auto it = std::lower_bound(
+    tokens.begin() + begin, tokens.end(), pos,
+    [](const CToken& t, const char* p) { return t.text.begin < p; });
+  return it - tokens.begin();
+}
+
+// Replaces tokens [begin, end) with 'src', without moving the tail when the
+// count doesn't change. Returns the index of the first token after 'src'.
+
+static size_t splice(std::vector<CToken>& tokens, size_t begin, size_t end,
+                     const std::vector<CToken>& src) {
+  if (end - begin == src.size()) {
+    std::copy(src.begin(), src.end(), tokens.begin() + begin);
+  } else {
+    tokens.erase(tokens.begin() + begin, tokens.begin() + end);
+    tokens.insert(tokens.begin() + begin, src.begin(), src.end());
+  }
+  return begin + src.size();
+}
+
+static void shift_text(std::vector<CToken>& tokens, size_t begin, ptrdiff_t delta) {
+  if (!delta) return;
+  for (size_t i = begin; i < tokens.size(); i++) {
+    tokens[i].text = TextSpan(tokens[i].text.begin + delta, tokens[i].text.end + delta);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+CIncrementalParser::CIncrementalParser() {}
+
+bool CIncrementalParser::parse(const std::string& source) {
+  text = source;
+  return reparse();
+}
+
+bool CIncrementalParser::reparse() {
+  // Edits are made in place, so keep room for the buffer and the token list to
+  // grow without moving.
+  text.reserve(text.size() * 2 + 4096);
+
+  lexer.reset();
+  context.reset();
+  items.clear();
+
+  full_parse = true;
+  dead_nodes = 0;
+  reused_nodes = 0;
+  reparsed_items = 0;
+  reparsed_nodes = 0;
+  total_nodes = 0;
+
+  auto text_span = utils::to_span(text);
+  parse_ok = lexer.lex(text_span);
+  relexed_tokens = lexer.tokens.size();
+  if (!parse_ok) return false;
+
+  context.tokens.reserve(lexer.tokens.size() * 2);
+  for (auto& t : lexer.tokens) {
+    if (!t.is_gap()) context.tokens.push_back(t);
+  }
+  context.text_span = text_span;
+  context.lexemes = utils::to_span(lexer.tokens);
+  context.fused_ops = lexer.fuse_ops;
+
+  parse_ok = parse_from(1);
+  total_nodes = reparsed_nodes;
+  return parse_ok;
+}
+
+//------------------------------------------------------------------------------
+
+bool CIncrementalParser::edit(size_t offset, size_t old_len, const std::string& new_text) {
+  if (offset > text.size() || old_len > text.size() - offset) return false;
+
+  ptrdiff_t delta = ptrdiff_t(new_text.size()) - ptrdiff_t(old_len);
+
+  if (!parse_ok || text.size() + delta >= text.capacity() || dead_nodes > total_nodes) {
+    text.replace(offset, old_len, new_text);
+    return reparse();
+  }
+
+  full_parse = false;
+  reused_nodes = 0;
+  reparsed_items = 0;
+  reparsed_nodes = 0;
+
+  auto& lexemes = lexer.tokens;
+  auto& tokens = context.tokens;
+
+  const char* old_begin = text.data();
+  const char* old_end = old_begin + text.size();
+  const char* edit_begin = old_begin + offset;
+  const char* edit_end = edit_begin + old_len;
+
+  //----------------------------------------
+  // The first declaration the edit could change is the first one whose
+  // horizon doesn't end before it, and we start lexing from the end of the one
+  // before that. Looking at the last real token means the match may have
+  // depended on where the tokens run out, so that counts as reaching any edit.
+
+  auto k = std::partition_point(items.begin(), items.end(), [&](const Item& item) {
+    if (item.horizon >= tokens.size() - 1) return false;
+    return tokens[item.horizon - 1].text.end < edit_begin;
+  }) - items.begin();
+
+  const char* relex_begin = k ? tokens[items[k - 1].token_end - 1].text.end : old_begin;
+  uint32_t ctx_begin = k ? items[k - 1].token_end : 1;
+  size_t lex_begin = first_token_at(lexemes, 1, relex_begin);
+  size_t lex_resync = first_token_at(lexemes, lex_begin, edit_end);
+
+  //----------------------------------------
+  // Save the types added from declaration k on. Names after the edit will
+  // move, names in it will change.
+
+  uint32_t type_base = k < ptrdiff_t(items.size()) ? items[k].type_mark
+                                                   : context.type_scope.type_count();
+  old_types.clear();
+  for (uint32_t i = type_base; i < context.type_scope.type_count(); i++) {
+    auto name = context.type_scope.type_name(i);
+    SavedType saved = {context.type_scope.type_kind(i), name, {}};
+    if (name.begin >= old_begin && name.begin <= old_end) {
+      if (name.begin >= edit_end) {
+        saved.name = TextSpan(name.begin + delta, name.end + delta);
+      } else if (name.end > edit_begin) {
+        saved.copy.assign(name.begin, name.end);
+      }
+    }
+    old_types.push_back(std::move(saved));
+  }
+
+  // The capacity check above should keep the buffer in place, but if it did
+  // move every token and node points at freed memory.
+  text.replace(offset, old_len, new_text);
+  if (text.data() != old_begin) return reparse();
+  const char* new_end = text.data() + text.size();
+
+  //----------------------------------------
+  // Re-lex until we land on the start of an old token from after the edit.
+  // Lexing only depends on where it starts, so the rest of the old tokens
+  // would come out the same.
+
+  new_lexemes.clear();
+  TextMatchContext lex_ctx;
+  const char* pos = relex_begin;
+  size_t lex_end = lex_resync;
+  while (1) {
+    while (lex_end < lexemes.size() && lexemes[lex_end].text.begin + delta < pos) lex_end++;
+    if (lex_end < lexemes.size() && lexemes[lex_end].text.begin + delta == pos) break;
+
+    auto token = lexer.next(lex_ctx, TextSpan(pos, new_end));
+    new_lexemes.push_back(token);
+    if (token.type == LEX_INVALID) return reparse();
+    if (token.type == LEX_EOF) {
+      lex_end = lexemes.size();
+      break;
+    }
+    pos = token.text.end;
+  }
+  relexed_tokens = new_lexemes.size();
+
+  new_tokens.clear();
+  for (auto& t : new_lexemes) {
+    if (!t.is_gap()) new_tokens.push_back(t);
+  }
+
+  size_t ctx_resync = lex_end < lexemes.size()
+    ? first_token_at(tokens, ctx_begin, lexemes[lex_end].text.begin)
+    : tokens.size();
+  ptrdiff_t shift = ptrdiff_t(ctx_begin + new_tokens.size()) - ptrdiff_t(ctx_resync);
+
+  // Nodes point into the token list, so it can't move.
+  if (tokens.size() + shift > tokens.capacity()) return reparse();
+
+  //----------------------------------------
+  // Splice the new tokens in and move the old ones after them.
+
+  shift_text(lexemes, splice(lexemes, lex_begin, lex_end, new_lexemes), delta);
+  shift_text(tokens, splice(tokens, ctx_begin, ctx_resync, new_tokens), delta);
+
+  context.text_span = utils::to_span(text);
+  context.lexemes = utils::to_span(lexemes);
+
+  //----------------------------------------
+  // Roll the parser back to the end of declaration k - 1 and parse from there.
+
+  old_items.assign(items.begin() + k, items.end());
+  items.resize(k);
+  old_cursor = 0;
+  old_type_base = type_base;
+  resync_token = uint32_t(ctx_resync);
+  token_shift = shift;
+
+  context.memo.invalidate();
+  context.type_scope.rewind(type_base);
+
+  CNode* keep_tail = nullptr;
+  for (auto i = k; i > 0 && !keep_tail; i--) keep_tail = items[i - 1].node;
+
+  old_top_tail = context.top_tail;
+  if (keep_tail) {
+    keep_tail->node_next = nullptr;
+  } else {
+    context.top_head = nullptr;
+  }
+  context.top_tail = keep_tail;
+
+  parse_ok = parse_from(ctx_begin);
+
+  // Whatever wasn't reused is garbage now.
+  for (size_t i = 0; i < old_cursor; i++) dead_nodes += old_items[i].node_count;
+  old_items.clear();
+  old_types.clear();
+  old_cursor = 0;
+
+  total_nodes = 0;
+  for (auto& item : items) total_nodes += item.node_count;
+  reused_nodes = total_nodes - reparsed_nodes;
+  return parse_ok;
+}
+
+//------------------------------------------------------------------------------
+// Parses declarations from 'token_index' to the end, or until the rest of the
+// old declarations can be reused.
+
+bool CIncrementalParser::parse_from(uint32_t token_index) {
+  auto base = context.tokens.data();
+  TokenSpan body(base + token_index, base + context.tokens.size() - 1);
+
+  while (!body.is_empty()) {
+    uint32_t token_begin = uint32_t(body.begin - base);
+    if (try_reuse(token_begin)) return true;
+
+    Item item;
+    item.token_begin = token_begin;
+    item.type_mark = context.type_scope.type_count();
+
+    auto old_tail = context.top_tail;
+    context.horizon = body.begin;
+    auto tail = NodeTranslationUnit::item::match(context, body);
+    if (!tail.is_valid() || tail.begin == body.begin) {
+      old_cursor = old_items.size();
+      return false;
+    }
+
+    item.token_end = uint32_t(tail.begin - base);
+    item.horizon = std::max(uint32_t(context.horizon - base) + 1, item.token_end);
+    if (!items.empty()) item.horizon = std::max(item.horizon, items.back().horizon);
+    item.node = context.top_tail != old_tail ? context.top_tail : nullptr;
+    item.node_count = item.node ? uint32_t(item.node->node_count()) : 0;
+    items.push_back(item);
+
+    reparsed_items++;
+    reparsed_nodes += item.node_count;
+    body = tail;
+  }
+
+  old_cursor = old_items.size();
+  return true;
+}
+
+//----------------------------------------
+// An old declaration can be reused if it starts where we are now, all its
+// tokens were kept, and the declarations we just reparsed added the same types
+// as the ones they replaced.
+
+bool CIncrementalParser::try_reuse(uint32_t token_index) {
+  while (old_cursor < old_items.size()) {
+    auto& old = old_items[old_cursor];
+    if (old.token_begin >= resync_token && old.token_begin + token_shift >= token_index) break;
+    old_cursor++;
+  }
+  if (old_cursor >= old_items.size()) return false;
+
+  auto& first = old_items[old_cursor];
+  if (first.token_begin + token_shift != token_index) return false;
+  if (!same_types()) return false;
+
+  auto& scope = context.type_scope;
+  uint32_t type_offset = first.type_mark - old_type_base;
+  uint32_t new_mark = scope.type_count();
+
+  CNode* head = nullptr;
+  for (size_t i = old_cursor; i < old_items.size(); i++) {
+    Item item = old_items[i];
+    item.token_begin += token_shift;
+    item.token_end += token_shift;
+    item.horizon += token_shift;
+    if (!items.empty()) item.horizon = std::max(item.horizon, items.back().horizon);
+    item.type_mark = item.type_mark - first.type_mark + new_mark;
+    if (item.node) {
+      if (token_shift) shift_spans(item.node, token_shift);
+      if (!head) head = item.node;
+    }
+    items.push_back(item);
+  }
+
+  if (head) {
+    head->node_prev = context.top_tail;
+    if (context.top_tail) {
+      context.top_tail->node_next = head;
+    } else {
+      context.top_head = head;
+    }
+    context.top_tail = old_top_tail;
+  }
+
+  for (size_t i = type_offset; i < old_types.size(); i++) {
+    scope.add_type(old_types[i].name, old_types[i].kind);
+  }
+  return true;
+}
+
+bool CIncrementalParser::same_types() const {
+  auto& scope = context.type_scope;
+  uint32_t count = scope.type_count() - old_type_base;
+  uint32_t old_count = old_items[old_cursor].type_mark - old_type_base;
+  if (count != old_count) return false;
+
+  for (uint32_t i = 0; i < count; i++) {
+    auto& old = old_types[i];
+    auto old_name = old.copy.empty() ? old.name : utils::to_span(old.copy);
+    auto new_name = scope.type_name(old_type_base + i);
+    if (scope.type_kind(old_type_base + i) != old.kind) return false;
+    if (old_name.len() != new_name.len()) return false;
+    if (memcmp(old_name.begin, new_name.begin, new_name.len())) return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,103 @@
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "examples/c_lexer/CLexer.hpp"
+#include "examples/c_parser/CContext.hpp"
+
+//------------------------------------------------------------------------------
+// Keeps a source buffer parsed as it gets edited.
+
+// A declaration's extent can depend on tokens past its end - alternatives that
+// failed further on - so the first declaration an edit could change is the
+// first one whose lookahead horizon reaches it. An edit re-lexes from the end
+// of the declaration before that until the new tokens line back up with the
+// old ones, then re-parses declarations until one starts on an old declaration
+// boundary with the same set of visible types as before. Everything after that
+// is reused as-is - tokens and nodes just get their pointers shifted.
+
+// Visible types are compared by name, so an edit that adds, removes or renames
+// a struct or typedef never resyncs and reparses to the end of the buffer.
+
+// Declarations replaced by an edit stay in the node allocator until the next
+// full parse, which happens once there are more of them than live nodes.
+
+struct CIncrementalParser {
+  CIncrementalParser();
+
+  // Replaces the whole buffer and parses it from scratch.
+  bool parse(const std::string& source);
+
+  // Replaces 'old_len' bytes at 'offset' with 'new_text' and reparses.
+  // Returns false without touching the buffer if the range is out of bounds.
+  bool edit(size_t offset, size_t old_len, const std::string& new_text);
+
+  double reuse_ratio() const {
+    return total_nodes ? double(reused_nodes) / double(total_nodes) : 0.0;
+  }
+
+  //----------------------------------------
+
+  // One top-level declaration. Tokens are indices into context.tokens,
+  // 'type_mark' is the scope's type_count() before it was parsed. 'horizon' is
+  // one past the furthest token the parser examined while matching this or
+  // any earlier declaration, so it never decreases from one item to the next.
+  struct Item {
+    uint32_t token_begin;
+    uint32_t token_end;
+    uint32_t horizon;
+    uint32_t type_mark;
+    uint32_t node_count;
+    CNode*   node;  // nullptr for a stray ';'
+  };
+
+  std::string text;
+  CLexer lexer;
+  CContext context;
+  std::vector<Item> items;
+  bool parse_ok = false;
+
+  // Stats for the last parse() or edit().
+  size_t total_nodes = 0;
+  size_t reused_nodes = 0;
+  size_t relexed_tokens = 0;
+  size_t reparsed_items = 0;
+  bool full_parse = false;
+
+  // Nodes from replaced declarations that are still in the allocator.
+  size_t dead_nodes = 0;
+
+ private:
+  struct SavedType {
+    CScope::TypeKind kind;
+    matcheroni::TextSpan name;
+    std::string copy;  // Names that were inside the edited text get copied
+  };
+
+  bool reparse();
+  bool parse_from(uint32_t token_index);
+  bool try_reuse(uint32_t token_index);
+  bool same_types() const;
+
+  // The state of the edit in progress - the declarations from the first one
+  // the edit could have changed onwards, the types they added, and how far
+  // their tokens moved.
+  std::vector<Item> old_items;
+  std::vector<SavedType> old_types;
+  size_t   old_cursor = 0;
+  uint32_t old_type_base = 0;
+  uint32_t resync_token = 0;
+  ptrdiff_t token_shift = 0;
+  CNode*   old_top_tail = nullptr;
+  size_t   reparsed_nodes = 0;
+
+  std::vector<CToken> new_lexemes;
+  std::vector<CToken> new_tokens;
+};
+
+//------------------------------------------------------------------------------
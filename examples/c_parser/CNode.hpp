@@ -81,6 +81,17 @@ struct CNode : public parseroni::NodeBase<CNode, CToken> {
 
   //----------------------------------------
 
+  // Set on function bodies that a lazy parse skipped, see CDeferredNode. Bit 0
+  // of 'flags' belongs to Parseroni. A deferred body that didn't parse when
+  // expanded stays deferred, with no children, and gets EXPAND_FAILED too.
+  static constexpr uint32_t DEFERRED = 2;
+  static constexpr uint32_t EXPAND_FAILED = 4;
+
+  bool is_deferred() const { return flags & DEFERRED; }
+  bool expand_failed() const { return flags & EXPAND_FAILED; }
+
+  //----------------------------------------
+
   int precedence = 0;
 
   // -2 = prefix, -1 = right-to-left, 0 = none, 1 = left-to-right, 2 = suffix
@@ -88,3 +99,12 @@ struct CNode : public parseroni::NodeBase<CNode, CToken> {
 };
 
 //------------------------------------------------------------------------------
+// A function body that was only brace-matched. It has no children until
+// CContext::expand() parses it, using the types that were visible here.
+
+struct CDeferredNode : public CNode {
+  uint32_t type_mark = 0;  // The type scope's type_count() at the body
+  uint32_t pad = 0;
+};
+
+//------------------------------------------------------------------------------
@@ -7,68 +7,117 @@
 #include "examples/c_parser/CContext.hpp"
 #include "examples/c_lexer/CToken.hpp"
 
-#include <string_view>
-
 using matcheroni::TextSpan;
 
-using std::string_view;
+//------------------------------------------------------------------------------
+
+CScope::CScope() {
+  entries.reserve(256);
+  slots.resize(512);
+  scope_marks.reserve(64);
+}
+
+// Everything lives in vectors that keep their capacity, so once they've grown
+// to fit the biggest file we've seen, pushing and popping scopes and resetting
+// between files don't allocate.
 
 void CScope::clear() {
-  class_types.clear();
-  struct_types.clear();
-  union_types.clear();
-  enum_types.clear();
-  typedef_types.clear();
+  rewind(0);
+  scope_marks.clear();
 }
 
-bool CScope::has_type(CContext& ctx, TokenSpan body, token_list& types) {
-  if(ctx.atom_cmp(*body.begin, LEX_IDENTIFIER)) {
-    return false;
+void CScope::push() { scope_marks.push_back(uint32_t(entries.size())); }
+
+bool CScope::pop() {
+  if (scope_marks.empty()) return false;
+
+  uint32_t mark = scope_marks.back();
+  scope_marks.pop_back();
+  return rewind(mark);
+}
+
+// Removes entries newest-first until there are only 'mark' left, touching only
+// the slots they were in.
+bool CScope::rewind(uint32_t mark) {
+  if (entries.size() == mark) return false;
+
+  uint32_t mask = uint32_t(slots.size() - 1);
+  while (entries.size() > mark) {
+    uint32_t index = uint32_t(entries.size());
+    uint32_t i = entries.back().hash & mask;
+    while (slots[i] != index) i = (i + 1) & mask;
+    slots[i] = 0;
+    entries.pop_back();
   }
+  return true;
+}
 
-  TextSpan span(body.begin->text.begin, body.begin->text.end);
+//----------------------------------------
+// FNV-1a, with the kind mixed in so each kind of type has its own namespace.
 
-  for (const auto& c : types) {
-    if (strcmp_span(span, c) == 0) return true;
+uint32_t CScope::hash_name(TextSpan name, TypeKind kind) {
+  uint32_t h = 2166136261u ^ kind;
+  for (auto c = name.begin; c < name.end; c++) {
+    h = (h ^ (unsigned char)*c) * 16777619u;
   }
+  return h;
+}
 
+bool CScope::has(TextSpan name, TypeKind kind) const {
+  uint32_t hash = hash_name(name, kind);
+  uint32_t mask = uint32_t(slots.size() - 1);
+  for (uint32_t i = hash & mask; slots[i]; i = (i + 1) & mask) {
+    const Entry& e = entries[slots[i] - 1];
+    if (e.hash == hash && e.kind == kind && strcmp_span(name, e.name) == 0) {
+      return true;
+    }
+  }
   return false;
 }
 
-void CScope::add_type(CContext& ctx, const CToken* a, token_list& types) {
-  matcheroni_assert(ctx.atom_cmp(*a, LEX_IDENTIFIER) == 0);
-
-  TextSpan span(a->text.begin, a->text.end);
+void CScope::add(TextSpan name, TypeKind kind) {
+  // A type that's already visible stays visible until the scope that added it
+  // is popped, which can't happen before this scope is popped.
+  if (has(name, kind)) return;
 
-  for (const auto& c : types) {
-    if (strcmp_span(span, c) == 0) return;
+  entries.push_back({hash_name(name, kind), kind, name});
+  if (entries.size() * 2 > slots.size()) {
+    grow();
+  } else {
+    insert_slot(uint32_t(entries.size() - 1));
   }
+}
 
-  types.push_back(span);
+void CScope::insert_slot(uint32_t index) {
+  uint32_t mask = uint32_t(slots.size() - 1);
+  uint32_t i = entries[index].hash & mask;
+  while (slots[i]) i = (i + 1) & mask;
+  slots[i] = index + 1;
 }
 
-//----------------------------------------
+// Entries are reinserted oldest-first, so pop() can still remove them
+// newest-first.
+void CScope::grow() {
+  slots.assign(slots.size() * 2, 0);
+  for (uint32_t i = 0; i < entries.size(); i++) insert_slot(i);
+}
 
-void CScope::add_typedef_type(const char* t) {
-  TextSpan span = matcheroni::utils::to_span(t);
+//----------------------------------------
 
-  for (const auto& c : typedef_types) {
-    if (strcmp_span(span, c) == 0) return;
+bool CScope::has_type(CContext& ctx, TokenSpan body, TypeKind kind) const {
+  if(ctx.atom_cmp(*body.begin, LEX_IDENTIFIER)) {
+    return false;
   }
+  return has(body.begin->text, kind);
+}
 
-  typedef_types.push_back(span);
+void CScope::add_type(CContext& ctx, const CToken* a, TypeKind kind) {
+  matcheroni_assert(ctx.atom_cmp(*a, LEX_IDENTIFIER) == 0);
+  add(a->text, kind);
 }
 
-//----------------------------------------
+void CScope::add_typedef_type(const char* t) {
+  add(matcheroni::utils::to_span(t), TYPEDEF_TYPE);
+}
 
-bool CScope::has_class_type  (CContext& ctx, TokenSpan body) { if (has_type(ctx, body, class_types  )) return true; if (parent) return parent->has_class_type  (ctx, body); else return false; }
-bool CScope::has_struct_type (CContext& ctx, TokenSpan body) { if (has_type(ctx, body, struct_types )) return true; if (parent) return parent->has_struct_type (ctx, body); else return false; }
-bool CScope::has_union_type  (CContext& ctx, TokenSpan body) { if (has_type(ctx, body, union_types  )) return true; if (parent) return parent->has_union_type  (ctx, body); else return false; }
-bool CScope::has_enum_type   (CContext& ctx, TokenSpan body) { if (has_type(ctx, body, enum_types   )) return true; if (parent) return parent->has_enum_type   (ctx, body); else return false; }
-bool CScope::has_typedef_type(CContext& ctx, TokenSpan body) { if (has_type(ctx, body, typedef_types)) return true; if (parent) return parent->has_typedef_type(ctx, body); else return false; }
-
-void CScope::add_class_type  (CContext& ctx, const CToken* a) { return add_type(ctx, a, class_types  ); }
-void CScope::add_struct_type (CContext& ctx, const CToken* a) { return add_type(ctx, a, struct_types ); }
-void CScope::add_union_type  (CContext& ctx, const CToken* a) { return add_type(ctx, a, union_types  ); }
-void CScope::add_enum_type   (CContext& ctx, const CToken* a) { return add_type(ctx, a, enum_types   ); }
-void CScope::add_typedef_type(CContext& ctx, const CToken* a) { return add_type(ctx, a, typedef_types); }
+//------------------------------------------------------------------------------
@@ -2,8 +2,8 @@
 // SPDX-License-Identifier: MIT License
 
 #pragma once
+#include <stdint.h>
 #include <vector>
-#include <string>
 #include "matcheroni/Matcheroni.hpp"
 
 struct CToken;
@@ -11,36 +11,74 @@ struct CContext;
 typedef matcheroni::Span<CToken> TokenSpan;
 
 //------------------------------------------------------------------------------
+// The stack of type scopes, stored as one open-addressing hash table keyed on
+// the type's kind and name. Entries are kept in the order they were added, and
+// a scope is just the number of entries there were when it was pushed - so
+// popping a scope removes its entries newest-first, which leaves every probe
+// sequence in the table exactly as it was before they went in.
 
 struct CScope {
+  enum TypeKind : uint8_t {
+    CLASS_TYPE,
+    STRUCT_TYPE,
+    UNION_TYPE,
+    ENUM_TYPE,
+    TYPEDEF_TYPE,
+  };
 
-  //using token_list = std::vector<const CToken*>;
-  using token_list = std::vector<matcheroni::TextSpan>;
+  CScope();
 
   void clear();
-  bool has_type(CContext& ctx, TokenSpan body, token_list& types);
-  void add_type(CContext& ctx, const CToken* a, token_list& types);
+  void push();
 
-  bool has_class_type  (CContext& ctx, TokenSpan body);
-  bool has_struct_type (CContext& ctx, TokenSpan body);
-  bool has_union_type  (CContext& ctx, TokenSpan body);
-  bool has_enum_type   (CContext& ctx, TokenSpan body);
-  bool has_typedef_type(CContext& ctx, TokenSpan body);
+  // Returns true if the popped scope had added any types.
+  bool pop();
 
-  void add_class_type  (CContext& ctx, const CToken* a);
-  void add_struct_type (CContext& ctx, const CToken* a);
-  void add_union_type  (CContext& ctx, const CToken* a);
-  void add_enum_type   (CContext& ctx, const CToken* a);
-  void add_typedef_type(CContext& ctx, const CToken* a);
+  bool has_type(CContext& ctx, TokenSpan body, TypeKind kind) const;
+  void add_type(CContext& ctx, const CToken* a, TypeKind kind);
+
+  bool has_class_type  (CContext& ctx, TokenSpan body) const { return has_type(ctx, body, CLASS_TYPE); }
+  bool has_struct_type (CContext& ctx, TokenSpan body) const { return has_type(ctx, body, STRUCT_TYPE); }
+  bool has_union_type  (CContext& ctx, TokenSpan body) const { return has_type(ctx, body, UNION_TYPE); }
+  bool has_enum_type   (CContext& ctx, TokenSpan body) const { return has_type(ctx, body, ENUM_TYPE); }
+  bool has_typedef_type(CContext& ctx, TokenSpan body) const { return has_type(ctx, body, TYPEDEF_TYPE); }
+
+  void add_class_type  (CContext& ctx, const CToken* a) { add_type(ctx, a, CLASS_TYPE); }
+  void add_struct_type (CContext& ctx, const CToken* a) { add_type(ctx, a, STRUCT_TYPE); }
+  void add_union_type  (CContext& ctx, const CToken* a) { add_type(ctx, a, UNION_TYPE); }
+  void add_enum_type   (CContext& ctx, const CToken* a) { add_type(ctx, a, ENUM_TYPE); }
+  void add_typedef_type(CContext& ctx, const CToken* a) { add_type(ctx, a, TYPEDEF_TYPE); }
 
   void add_typedef_type(const char* t);
 
-  CScope* parent;
-  token_list class_types;
-  token_list struct_types;
-  token_list union_types;
-  token_list enum_types;
-  token_list typedef_types;
+  //----------------------------------------
+  // CIncrementalParser saves and restores the types added by each top-level
+  // declaration. type_count() is a watermark for rewind().
+
+  uint32_t type_count() const { return uint32_t(entries.size()); }
+  TypeKind type_kind(uint32_t i) const { return entries[i].kind; }
+  matcheroni::TextSpan type_name(uint32_t i) const { return entries[i].name; }
+
+  void add_type(matcheroni::TextSpan name, TypeKind kind) { add(name, kind); }
+  bool rewind(uint32_t mark);
+
+ private:
+  struct Entry {
+    uint32_t hash;
+    TypeKind kind;
+    matcheroni::TextSpan name;
+  };
+
+  static uint32_t hash_name(matcheroni::TextSpan name, TypeKind kind);
+
+  bool has(matcheroni::TextSpan name, TypeKind kind) const;
+  void add(matcheroni::TextSpan name, TypeKind kind);
+  void insert_slot(uint32_t index);
+  void grow();
+
+  std::vector<Entry> entries;
+  std::vector<uint32_t> slots;  // Index into entries plus one, or zero if empty
+  std::vector<uint32_t> scope_marks;
 };
 
 //------------------------------------------------------------------------------
@@ -436,6 +436,19 @@ constexpr std::array binary_operators = {
   "||",
 };
 
+//------------------------------------------------------------------------------
+// Every punctuator the lexer can produce. Doesn't need to be sorted.
+
+constexpr std::array c_operators = {
+  "...", "<<=", ">>=", "->*", "<=>",
+
+  "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+  "*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=", "::", ".*", "##",
+
+  "-", ",", ";", ":", "!", "?", ".", "(", ")", "[", "]", "{", "}",
+  "*", "/", "&", "#", "%", "^", "+", "<", "=", ">", "|", "~",
+};
+
 constexpr std::array stddef_typedefs = {
   "size_t",
   "ptrdiff_t",
@@ -0,0 +1,181 @@
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+//------------------------------------------------------------------------------
+// Times CIncrementalParser on single-character edits - insert a 'z' at the end
+// of a random identifier, reparse, delete it again, reparse. Every so often the
+// incremental tree gets checked against a parse of the same text from scratch.
+
+// With no file argument it generates a ~10k line source file to edit.
+
+// Example usage:
+// bin/examples/c_parser/c_incremental_benchmark
+// bin/examples/c_parser/c_incremental_benchmark some_file.c 5000
+// bin/examples/c_parser/c_incremental_benchmark some_file.c 5000 1 (check every edit)
+
+#include "matcheroni/Utilities.hpp"
+
+#include "examples/c_parser/CIncremental.hpp"
+#include "examples/c_parser/CNode.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using namespace matcheroni;
+
+//------------------------------------------------------------------------------
+
+std::string generate_source(int line_target) {
+  std::string source;
+  char buf[1024];
+
+  source += "typedef unsigned int uint;\n\n";
+  int lines = 2;
+  for (int i = 0; lines < line_target; i++) {
+    if (i % 8 == 0) {
+      snprintf(buf, sizeof(buf),
+        "typedef struct s%d {\n"
+        "  int a;\n"
+        "  float b[%d];\n"
+        "} t%d;\n"
+        "\n",
+        i, i % 13 + 1, i);
+      lines += 5;
+    }
+    else {
+      int t = i & ~7;
+      snprintf(buf, sizeof(buf),
+        "// Function number %d\n"
+        "t%d func%d(t%d* p, int n) {\n"
+        "  int x = n * %d;\n"
+        "  for (int i = 0; i < n; i++) {\n"
+        "    x += p->a + i;\n"
+        "    if (x > %d) x = (x >> 1) ^ p[i].a;\n"
+        "  }\n"
+        "  p->b[0] = (float)x / 3.0f;\n"
+        "  return *p;\n"
+        "}\n"
+        "\n",
+        i, t, i, t, i, i * 7);
+      lines += 11;
+    }
+    source += buf;
+  }
+  return source;
+}
+
+//------------------------------------------------------------------------------
+
+bool same_parse(CIncrementalParser& inc, CIncrementalParser& fresh) {
+  fresh.parse(inc.text);
+  if (fresh.parse_ok != inc.parse_ok) return false;
+  if (fresh.items.size() != inc.items.size()) return false;
+  if (fresh.lexer.tokens.size() != inc.lexer.tokens.size()) return false;
+  for (size_t i = 0; i < fresh.lexer.tokens.size(); i++) {
+    auto& a = fresh.lexer.tokens[i];
+    auto& b = inc.lexer.tokens[i];
+    if (a.type != b.type) return false;
+    if (a.text.begin - fresh.text.data() != b.text.begin - inc.text.data()) return false;
+    if (a.text.len() != b.text.len()) return false;
+  }
+  return utils::hash_context(fresh.context) == utils::hash_context(inc.context);
+}
+
+double percentile(std::vector<double>& v, double p) {
+  std::sort(v.begin(), v.end());
+  return v[size_t(p * double(v.size() - 1))];
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  std::string source = argc > 1 ? utils::read(argv[1]) : generate_source(10000);
+  int edit_count = argc > 2 ? atoi(argv[2]) : 2000;
+  int check_every = argc > 3 ? atoi(argv[3]) : 50;
+
+  int line_count = int(std::count(source.begin(), source.end(), '\n'));
+  printf("Incremental parse benchmark, %d lines, %d bytes\n", line_count, int(source.size()));
+
+  CIncrementalParser inc;
+  CIncrementalParser fresh;
+
+  double full_ms = -utils::wallclock_ms();
+  inc.parse(source);
+  full_ms += utils::wallclock_ms();
+
+  if (!inc.parse_ok) {
+    printf("Initial parse failed\n");
+    return -1;
+  }
+  printf("Full parse          %10.3f ms, %ld nodes, %ld declarations\n",
+         full_ms, inc.total_nodes, inc.items.size());
+
+  std::vector<double> times;
+  double reuse_total = 0;
+  size_t relexed_total = 0;
+  size_t reparsed_total = 0;
+  int full_parses = 0;
+  int failed = 0;
+  int mismatches = 0;
+
+  srand(1);
+  for (int i = 0; i < edit_count; i++) {
+    // Pick an identifier that isn't a typedef, renaming those breaks the parse.
+    std::vector<size_t> offsets;
+    for (auto& t : inc.context.tokens) {
+      if (t.type != LEX_IDENTIFIER) continue;
+      if (inc.context.type_scope.has_typedef_type(inc.context, TokenSpan(&t, &t + 1))) continue;
+      offsets.push_back(t.text.end - inc.text.data());
+    }
+    if (offsets.empty()) {
+      printf("No identifiers to edit\n");
+      return -1;
+    }
+    size_t offset = offsets[rand() % offsets.size()];
+
+    for (int pass = 0; pass < 2; pass++) {
+      double time = -utils::wallclock_ms();
+      bool ok = pass == 0 ? inc.edit(offset, 0, "z") : inc.edit(offset, 1, "");
+      time += utils::wallclock_ms();
+
+      times.push_back(time * 1000.0);
+      reuse_total += inc.reuse_ratio();
+      relexed_total += inc.relexed_tokens;
+      reparsed_total += inc.reparsed_items;
+      if (inc.full_parse) full_parses++;
+      if (!ok) failed++;
+
+      // Check the edited text as well as the text after it's put back.
+      if (i % check_every == 0 || i == edit_count - 1) {
+        if (!same_parse(inc, fresh)) {
+          printf("Mismatch after %s %d at offset %ld\n", pass ? "delete" : "insert", i, offset);
+          mismatches++;
+        }
+      }
+    }
+  }
+
+  double total = 0;
+  for (auto t : times) total += t;
+  double mean = total / double(times.size());
+
+  printf("Edits               %10ld\n", times.size());
+  printf("Mean latency        %10.2f us\n", mean);
+  printf("p50 latency         %10.2f us\n", percentile(times, 0.5));
+  printf("p99 latency         %10.2f us\n", percentile(times, 0.99));
+  printf("Max latency         %10.2f us\n", times.back());
+  printf("Speedup vs full     %10.1fx\n", full_ms * 1000.0 / mean);
+  printf("Mean reuse ratio    %10.4f\n", reuse_total / double(times.size()));
+  printf("Mean relexed tokens %10.2f\n", double(relexed_total) / double(times.size()));
+  printf("Mean reparsed decls %10.2f\n", double(reparsed_total) / double(times.size()));
+  printf("Full reparses       %10d\n", full_parses);
+  printf("Failed parses       %10d\n", failed);
+  printf("Mismatches          %10d\n", mismatches);
+
+  return mismatches ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
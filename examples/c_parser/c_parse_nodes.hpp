@@ -11,7 +11,6 @@
 #include "examples/c_lexer/CToken.hpp"
 #include "examples/c_parser/CNode.hpp"
 #include "examples/c_parser/CContext.hpp"
-#include "examples/SST.hpp"
 
 using namespace matcheroni;
 using namespace parseroni;
@@ -117,12 +116,14 @@ using opt_comma_separated = Opt<comma_separated<P>>;
 
 template <StringParam lit>
 struct Keyword : public CNode, PatternWrapper<Keyword<lit>> {
-  static_assert(SST<c_keywords>::contains(lit.str_val));
+  // Only keywords have keyword word ids, so comparing ids is enough.
+  static constexpr int word = c_words::id(lit.str_val);
+  static_assert(c_words::in_table(word, WORD_KEYWORD));
 
   static TokenSpan match(CContext& ctx, TokenSpan body) {
     if (!body.is_valid()) return body.fail();
-    if (ctx.atom_cmp(*body.begin, LEX_KEYWORD) != 0) return body.fail();
-    if (ctx.atom_cmp(*body.begin, lit.span()) != 0) return body.fail();
+    ctx.touch(body.begin);
+    if (body.begin->word != word) return body.fail();
     return body.advance(1);
   }
 };
@@ -138,12 +139,19 @@ struct Literal2 : public CNode, PatternWrapper<Literal2<lit>> {
 
 //------------------------------------------------------------------------------
 
+// Single-character punctuators, and any punctuator if the lexer fused them,
+// match on their operator id. Otherwise multi-character ones are matched a
+// character at a time.
+
 template <StringParam lit>
 inline TokenSpan match_punct(CContext& ctx, TokenSpan body) {
-  if (!body.is_valid()) return body.fail();
+  static constexpr int op = c_ops::id(lit.str_val);
+  static_assert(op != OP_NONE);
 
-  size_t lit_len = lit.str_len;
-  const char* lit_val = lit.str_val;
+  if (!body.is_valid() || body.is_empty()) return body.fail();
+  ctx.touch(body.begin);
+  if (body.begin->op == op) return body.advance(1);
+  if (lit.str_len == 1 || ctx.fused_ops) return body.fail();
 
   if (body.len() < lit.str_len) return body.fail();
 
@@ -233,19 +241,19 @@ struct NodePreproc : public CNode /*, PatternWrapper<NodePreproc>*/ {
 
       if (s.find("stdio") != std::string::npos) {
         for (auto t : stdio_typedefs) {
-          ctx.type_scope->add_typedef_type(t);
+          ctx.add_typedef_type(t);
         }
       }
 
       if (s.find("stdint") != std::string::npos) {
         for (auto t : stdint_typedefs) {
-          ctx.type_scope->add_typedef_type(t);
+          ctx.add_typedef_type(t);
         }
       }
 
       if (s.find("stddef") != std::string::npos) {
         for (auto t : stddef_typedefs) {
-          ctx.type_scope->add_typedef_type(t);
+          ctx.add_typedef_type(t);
         }
       }
 
@@ -308,8 +316,8 @@ struct NodeSuffixOp : public CNode, PatternWrapper<NodeSuffixOp<lit>> {
 struct NodeQualifier : public CNode, PatternWrapper<NodeQualifier> {
   static TokenSpan match(CContext& ctx, TokenSpan body) {
     matcheroni_assert(body.is_valid());
-    TextSpan span = body.begin->text;
-    if (SST<qualifiers>::match(span.begin, span.end)) {
+    ctx.touch(body.begin);
+    if (body.begin->in_words(WORD_QUALIFIER)) {
       return body.advance(1);
     }
     else {
@@ -817,7 +825,7 @@ struct NodeExpression : public CNode, PatternWrapper<NodeExpression> {
 
   static TokenSpan match(CContext& ctx, TokenSpan body) {
     //print_trace_start<NodeExpression, CToken>(a);
-    auto tail = match2(ctx, body);
+    auto tail = Memo<"expression", Ref<match2>>::match(ctx, body);
     if (tail.is_valid()) {
       //auto node = new NodeExpression();
       //node->init_node(ctx, a, tail - 1, a->span, (tail - 1)->span);
@@ -952,12 +960,12 @@ struct NodeParam : public CNode, public PatternWrapper<NodeParam> {
 
 struct NodeParamList : public CNode, public PatternWrapper<NodeParamList> {
   using pattern =
-  DelimitedList<
+  Memo<"param_list", DelimitedList<
     Atom<'('>,
     Cap<"param", NodeParam>,
     Atom<','>,
     Atom<')'>
-  >;
+  >>;
 };
 
 //------------------------------------------------------------------------------
@@ -1450,6 +1458,16 @@ struct NodeFunctionIdentifier : public CNode,
   // clang-format on
 };
 
+// Lazy parses only brace-match function bodies, see CContext::lazy_bodies.
+
+struct NodeFunctionBody {
+  template <typename context>
+  static TokenSpan match(context& ctx, TokenSpan body) {
+    if (ctx.lazy_bodies) return ctx.match_deferred_body(body);
+    return Cap<"func_body", NodeStatementCompound>::match(ctx, body);
+  }
+};
+
 // function-definition:
 //     declaration-specifiers declarator declaration-listopt compound-statement
 
@@ -1467,7 +1485,7 @@ struct NodeFunctionDefinition : public CNode,
     Opt<Cap<"asm_suffix",       NodeAsmSuffix>>,
     Opt<Cap<"const",            NodeKeyword<"const">>>,
     Any<Cap<"old_declaration",  Seq<NodeDeclaration, Atom<';'>> >>, // This is old-style declarations after param list
-    One<Cap<"func_body",        NodeStatementCompound>>
+    One<NodeFunctionBody>
   >;
   // clang-format on
 };
@@ -1812,12 +1830,12 @@ struct NodeTypedef : public CNode, public PatternWrapper<NodeTypedef> {
 
   static void extract_declarator(CContext& ctx, CNode* decl) {
     /*
-    if (auto id = decl->child("identifier")) {
+    if (auto id = decl->child<"identifier">()) {
       ctx.add_typedef_type(id->span.a);
     }
     */
-    if (auto name = decl->child("name")) {
-      if (auto id = name->child("identifier")) {
+    if (auto name = decl->child<"name">()) {
+      if (auto id = name->child<"identifier">()) {
         ctx.add_typedef_type(id->span.begin);
       }
     }
@@ -1835,7 +1853,7 @@ struct NodeTypedef : public CNode, public PatternWrapper<NodeTypedef> {
     if (!decls) return;
     for (auto child = decls->child_head; child; child = child->node_next) {
 
-      if (strcmp(child->match_tag, "decl") == 0) {
+      if (child->tag_is<"decl">()) {
         extract_declarator(ctx, child);
       }
       else {
@@ -1851,28 +1869,28 @@ struct NodeTypedef : public CNode, public PatternWrapper<NodeTypedef> {
   static void extract_type(CContext& ctx) {
     auto node = ctx.top_tail;
 
-    if (auto c = node->child("union")) {
-      extract_declarator_list(ctx, c->child("decls"));
+    if (auto c = node->child<"union">()) {
+      extract_declarator_list(ctx, c->child<"decls">());
       return;
     }
 
-    if (auto c = node->child("struct")) {
-      extract_declarator_list(ctx, c->child("decls"));
+    if (auto c = node->child<"struct">()) {
+      extract_declarator_list(ctx, c->child<"decls">());
       return;
     }
 
-    if (auto c = node->child("class")) {
-      extract_declarator_list(ctx, c->child("decls"));
+    if (auto c = node->child<"class">()) {
+      extract_declarator_list(ctx, c->child<"decls">());
       return;
     }
 
-    if (auto c = node->child("enum")) {
-      extract_declarator_list(ctx, c->child("decls"));
+    if (auto c = node->child<"enum">()) {
+      extract_declarator_list(ctx, c->child<"decls">());
       return;
     }
 
-    if (auto c = node->child("decl")) {
-      extract_declarator_list(ctx, c->child("decls"));
+    if (auto c = node->child<"decl">()) {
+      extract_declarator_list(ctx, c->child<"decls">());
       return;
     }
 
@@ -1939,24 +1957,25 @@ struct NodeStatement : public PatternWrapper<NodeStatement> {
 //------------------------------------------------------------------------------
 
 struct NodeTranslationUnit : public CNode, public PatternWrapper<NodeTranslationUnit> {
+  // One top-level declaration. CIncrementalParser matches these one at a time.
   // clang-format off
-  using pattern =
-  Any<
-    Oneof<
-      Cap<"class",       Seq<NodeClass,  Atom<';'>>>,
-      Cap<"struct",      Seq<NodeStruct, Atom<';'>>>,
-      Cap<"union",       Seq<NodeUnion,  Atom<';'>>>,
-      Cap<"enum",        Seq<NodeEnum,   Atom<';'>>>,
-      Cap<"typedef",     NodeTypedef>,
-      Cap<"preproc",     NodePreproc>,
-      Cap<"template",    Seq<NodeTemplate, Atom<';'>>>,
-      Cap<"function",    NodeFunctionDefinition>,
-      Cap<"declaration", Seq<NodeDeclaration, Atom<';'>>>,
-      Cap<"namespace",   NodeNamespace>,
-      Atom<';'>
-    >
+  using item =
+  Oneof<
+    Cap<"class",       Seq<NodeClass,  Atom<';'>>>,
+    Cap<"struct",      Seq<NodeStruct, Atom<';'>>>,
+    Cap<"union",       Seq<NodeUnion,  Atom<';'>>>,
+    Cap<"enum",        Seq<NodeEnum,   Atom<';'>>>,
+    Cap<"typedef",     NodeTypedef>,
+    Cap<"preproc",     NodePreproc>,
+    Cap<"template",    Seq<NodeTemplate, Atom<';'>>>,
+    Cap<"function",    NodeFunctionDefinition>,
+    Cap<"declaration", Seq<NodeDeclaration, Atom<';'>>>,
+    Cap<"namespace",   NodeNamespace>,
+    Atom<';'>
   >;
   // clang-format on
+
+  using pattern = Any<item>;
 };
 
 //------------------------------------------------------------------------------
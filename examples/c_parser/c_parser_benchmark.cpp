@@ -1,7 +1,10 @@
 // SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
 // SPDX-License-Identifier: MIT License
 
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <thread>
 
 #include "matcheroni/Utilities.hpp"
 
@@ -13,6 +16,9 @@ using namespace matcheroni;
 
 bool verbose = false;
 
+// Comment this out to load files with utils::read() instead of mapping them.
+#define USE_MMAP
+
 //------------------------------------------------------------------------------
 // File filters
 
@@ -85,19 +91,33 @@ bool should_skip(const std::string& path) {
 }
 
 //------------------------------------------------------------------------------
+// Each thread owns a ParseWorker with its own lexer, context, and node
+// allocator, so nothing is shared between threads except the list of paths
+// and the per-file result hashes.
 
-int test_parser(int argc, char** argv) {
-  printf("Matcheroni c_parser_benchmark\n");
-
-  std::vector<std::string> paths;
-  const char* base_path = argc > 1 ? argv[1] : "tests";
+struct ParseWorker {
+  void parse_file(const std::string& path, uint64_t& hash_out);
 
   CLexer lexer;
   CContext context;
+#ifdef USE_MMAP
+  utils::MappedFile file;
+#else
+  std::string text;
+#endif
 
   double io_time = 0;
   double lex_time = 0;
   double parse_time = 0;
+  double parse_time_nomemo = 0;
+  double lazy_parse_time = 0;
+  double expand_time = 0;
+  double fused_lex_time = 0;
+  double fused_parse_time = 0;
+  double walk_time = 0;
+  double compact_time = 0;
+  double flat_walk_time = 0;
+  double visit_walk_time = 0;
   double cleanup_time = 0;
 
   int file_pass = 0;
@@ -105,6 +125,223 @@ int test_parser(int argc, char** argv) {
   int file_skip = 0;
   int file_bytes = 0;
   int file_lines = 0;
+  int memo_mismatch = 0;
+  int lazy_mismatch = 0;
+  int lazy_skip = 0;
+  int fused_mismatch = 0;
+  int compact_mismatch = 0;
+  size_t split_tokens = 0;
+  size_t fused_tokens = 0;
+};
+
+//----------------------------------------
+
+void ParseWorker::parse_file(const std::string& path, uint64_t& hash_out) {
+  TextSpan text_span;
+
+  {
+    if (verbose) printf("Cleaning up\n");
+    cleanup_time -= utils::thread_time_ms();
+    lexer.reset();
+    context.reset();
+    cleanup_time += utils::thread_time_ms();
+  }
+
+  {
+    if (verbose) printf("Loading %s\n", path.c_str());
+    io_time -= utils::thread_time_ms();
+
+#ifdef USE_MMAP
+    file.open(path.c_str());
+    text_span = file.span();
+#else
+    text.clear();
+    utils::read(path.c_str(), text);
+    text_span = utils::to_span(text);
+#endif
+    for (auto c = text_span.begin; c < text_span.end; c++) if (*c == '\n') file_lines++;
+    file_bytes += text_span.len();
+
+    io_time += utils::thread_time_ms();
+  }
+
+  if (verbose) printf("Lexing %s\n", path.c_str());
+  lex_time -= utils::thread_time_ms();
+  lexer.lex(text_span);
+  lex_time += utils::thread_time_ms();
+
+  // Filter all files containing preproc, but not if they're a csmith file
+  if (path.find("csmith") == std::string::npos) {
+    bool has_preproc = false;
+    for (auto& l : lexer.tokens) {
+      if (l.type == LEX_PREPROC) {
+        //has_preproc = true;
+        break;
+      }
+    }
+    if (has_preproc) {
+      file_skip++;
+      return;
+    }
+  }
+
+  TokenSpan tok_span(lexer.tokens.data(), lexer.tokens.data() + lexer.tokens.size());
+
+  // Parse once without memoization so we can see how much time it saves,
+  // then again with it.
+  if (verbose) printf("Parsing %s without memo\n", path.c_str());
+  context.memo.enabled = false;
+  parse_time_nomemo -= utils::thread_time_ms();
+  context.parse(text_span, tok_span);
+  parse_time_nomemo += utils::thread_time_ms();
+  uint64_t nomemo_hash = utils::hash_context(context);
+  context.reset();
+  context.memo.enabled = true;
+
+  if (verbose) printf("Parsing %s\n", path.c_str());
+  parse_time -= utils::thread_time_ms();
+  bool parse_ok = context.parse(text_span, tok_span);
+  parse_time += utils::thread_time_ms();
+
+  if (!parse_ok) {
+    file_fail++;
+    printf("\n");
+    printf("fail!\n");
+    printf("Parsing failed: %s\n", path.c_str());
+    return;
+  }
+
+  hash_out = utils::hash_context(context);
+  bool parse_complete = context.parse_complete;
+
+  if (nomemo_hash != hash_out) {
+    memo_mismatch++;
+    printf("Memo parse mismatch: %s\n", path.c_str());
+  }
+
+  // Walk the tree where the parser left it, then again after compact() moves
+  // it into one preorder array - following the node links, then visiting the
+  // array in order.
+  walk_time -= utils::thread_time_ms();
+  auto shape = utils::hash_shape(context);
+  walk_time += utils::thread_time_ms();
+
+  compact_time -= utils::thread_time_ms();
+  bool compacted = context.compact();
+  compact_time += utils::thread_time_ms();
+
+  if (!compacted) {
+    compact_mismatch++;
+    printf("Compact failed: %s\n", path.c_str());
+  } else {
+    flat_walk_time -= utils::thread_time_ms();
+    auto flat_shape = utils::hash_shape(context);
+    flat_walk_time += utils::thread_time_ms();
+
+    visit_walk_time -= utils::thread_time_ms();
+    auto visit_shape = utils::hash_shape_flat(context.flat);
+    visit_walk_time += utils::thread_time_ms();
+
+    if (flat_shape != shape || visit_shape != shape ||
+        utils::hash_context(context) != hash_out ||
+        utils::hash_flat(context.flat) != hash_out) {
+      compact_mismatch++;
+      printf("Compacted tree mismatch: %s\n", path.c_str());
+    }
+  }
+
+  // Parse again with function bodies deferred - all an indexer needs - then
+  // expand them and check we get the same tree. A parse that stopped partway
+  // can stop somewhere else when bodies are skipped, so only files the full
+  // parse consumed completely are compared.
+  if (verbose) printf("Parsing %s lazily\n", path.c_str());
+  context.reset();
+  context.lazy_bodies = true;
+  lazy_parse_time -= utils::thread_time_ms();
+  context.parse(text_span, tok_span);
+  lazy_parse_time += utils::thread_time_ms();
+  context.lazy_bodies = false;
+
+  expand_time -= utils::thread_time_ms();
+  bool expanded = context.expand_all();
+  expand_time += utils::thread_time_ms();
+
+  if (!parse_complete) {
+    lazy_skip++;
+  } else if (!expanded) {
+    lazy_mismatch++;
+    printf("Lazy expand failed: %s\n", path.c_str());
+  } else if (utils::hash_context(context) != hash_out) {
+    lazy_mismatch++;
+    printf("Lazy parse mismatch: %s\n", path.c_str());
+  }
+  split_tokens += context.tokens.size();
+
+  // And once more with multi-character operators lexed as single tokens.
+  if (verbose) printf("Parsing %s with fused operators\n", path.c_str());
+  lexer.reset();
+  lexer.fuse_ops = true;
+  fused_lex_time -= utils::thread_time_ms();
+  lexer.lex(text_span);
+  fused_lex_time += utils::thread_time_ms();
+  lexer.fuse_ops = false;
+
+  context.reset();
+  context.fused_ops = true;
+  fused_parse_time -= utils::thread_time_ms();
+  context.parse(text_span, utils::to_span(lexer.tokens));
+  fused_parse_time += utils::thread_time_ms();
+  context.fused_ops = false;
+  fused_tokens += context.tokens.size();
+
+  if (utils::hash_context(context) != hash_out) {
+    fused_mismatch++;
+    printf("Fused operator mismatch: %s\n", path.c_str());
+  }
+
+  file_pass++;
+  if (verbose) {
+    printf("\n");
+    printf("Dumping tree:\n");
+    //print_context(span, context, 40);
+    printf("\n");
+  }
+}
+
+//------------------------------------------------------------------------------
+// Files are split into one contiguous shard per thread. Each thread works
+// through its own shard first and then steals from the others, so a thread
+// that draws a run of large files doesn't hold everyone else up.
+
+struct alignas(64) Shard {
+  std::atomic<int> cursor;
+  int end;
+};
+
+void run_worker(ParseWorker& worker, Shard* shards, int shard_count, int index,
+                const std::vector<std::string>& paths,
+                std::vector<uint64_t>& hashes) {
+  for (int i = 0; i < shard_count; i++) {
+    Shard& shard = shards[(index + i) % shard_count];
+    while (1) {
+      int f = shard.cursor.fetch_add(1, std::memory_order_relaxed);
+      if (f >= shard.end) break;
+      worker.parse_file(paths[f], hashes[f]);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+
+int test_parser(int argc, char** argv) {
+  printf("Matcheroni c_parser_benchmark\n");
+
+  std::vector<std::string> paths;
+  const char* base_path = argc > 1 ? argv[1] : "tests";
+  int thread_count = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+  if (thread_count < 1) thread_count = 1;
+
+  int file_skip = 0;
 
 #if 0
   paths = {
@@ -113,6 +350,7 @@ int test_parser(int argc, char** argv) {
   };
 
   verbose = true;
+  thread_count = 1;
 
 #else
 
@@ -132,78 +370,111 @@ int test_parser(int argc, char** argv) {
   }
 #endif
 
+  // Sorted so that the merged hash doesn't depend on directory order.
+  std::sort(paths.begin(), paths.end());
 
-  std::string text;
-  text.reserve(65536);
-
-  for (const auto& path : paths) {
-    {
-      if (verbose) printf("Cleaning up\n");
-      cleanup_time -= utils::timestamp_ms();
-      lexer.reset();
-      context.reset();
-      cleanup_time += utils::timestamp_ms();
-    }
-
-    {
-      if (verbose) printf("Loading %s\n", path.c_str());
-      io_time -= utils::timestamp_ms();
+  printf("Using %d threads\n", thread_count);
 
-      text.clear();
-      utils::read(path.c_str(), text);
-      for (auto c : text) if (c == '\n') file_lines++;
-      file_bytes += text.size();
+  std::vector<ParseWorker> workers(thread_count);
+  std::vector<uint64_t> hashes(paths.size(), 0);
 
-      io_time += utils::timestamp_ms();
-    }
+  Shard* shards = new Shard[thread_count];
+  for (int i = 0; i < thread_count; i++) {
+    shards[i].cursor = int(paths.size() * i / thread_count);
+    shards[i].end    = int(paths.size() * (i + 1) / thread_count);
+  }
 
-    if (verbose) printf("Lexing %s\n", path.c_str());
-    lex_time -= utils::timestamp_ms();
-    auto text_span = utils::to_span(text);
-    lexer.lex(text_span);
-    lex_time += utils::timestamp_ms();
-
-    // Filter all files containing preproc, but not if they're a csmith file
-    if (path.find("csmith") == std::string::npos) {
-      bool has_preproc = false;
-      for (auto& l : lexer.tokens) {
-        if (l.type == LEX_PREPROC) {
-          //has_preproc = true;
-          break;
-        }
-      }
-      if (has_preproc) {
-        file_skip++;
-        continue;
-      }
+  double wall_time = -utils::wallclock_ms();
+  if (thread_count == 1) {
+    run_worker(workers[0], shards, 1, 0, paths, hashes);
+  } else {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++) {
+      threads.emplace_back(run_worker, std::ref(workers[i]), shards,
+                           thread_count, i, std::cref(paths), std::ref(hashes));
     }
+    for (auto& t : threads) t.join();
+  }
+  wall_time += utils::wallclock_ms();
 
-    TokenSpan tok_span(lexer.tokens.data(), lexer.tokens.data() + lexer.tokens.size());
+  delete [] shards;
 
-    if (verbose) printf("%04d: Parsing %s\n", file_pass, path.c_str());
-    parse_time -= utils::timestamp_ms();
-    bool parse_ok = context.parse(text_span, tok_span);
-    parse_time += utils::timestamp_ms();
+  //----------------------------------------
+  // Merge the per-thread results.
 
-    if (!parse_ok) {
-      file_fail++;
-      printf("\n");
-      printf("fail!\n");
-      printf("Parsing failed: %s\n", path.c_str());
-      exit(1);
-    }
+  double io_time = 0;
+  double lex_time = 0;
+  double parse_time = 0;
+  double parse_time_nomemo = 0;
+  double lazy_parse_time = 0;
+  double expand_time = 0;
+  double fused_lex_time = 0;
+  double fused_parse_time = 0;
+  double walk_time = 0;
+  double compact_time = 0;
+  double flat_walk_time = 0;
+  double visit_walk_time = 0;
+  double cleanup_time = 0;
 
-    file_pass++;
-    if (verbose) {
-      printf("\n");
-      printf("Dumping tree:\n");
-      //print_context(span, context, 40);
-      printf("\n");
-    }
+  int file_pass = 0;
+  int file_fail = 0;
+  int file_bytes = 0;
+  int file_lines = 0;
+  int memo_mismatch = 0;
+  int lazy_mismatch = 0;
+  int lazy_skip = 0;
+  int fused_mismatch = 0;
+  int compact_mismatch = 0;
+  size_t split_tokens = 0;
+  size_t fused_tokens = 0;
+
+  size_t memo_lookups = 0;
+  size_t memo_hits = 0;
+  size_t memo_stores = 0;
+  size_t memo_replayed = 0;
+
+  for (auto& w : workers) {
+    io_time           += w.io_time;
+    lex_time          += w.lex_time;
+    parse_time        += w.parse_time;
+    parse_time_nomemo += w.parse_time_nomemo;
+    lazy_parse_time   += w.lazy_parse_time;
+    expand_time       += w.expand_time;
+    fused_lex_time    += w.fused_lex_time;
+    fused_parse_time  += w.fused_parse_time;
+    walk_time         += w.walk_time;
+    compact_time      += w.compact_time;
+    flat_walk_time    += w.flat_walk_time;
+    visit_walk_time   += w.visit_walk_time;
+    cleanup_time      += w.cleanup_time;
+
+    file_pass  += w.file_pass;
+    file_fail  += w.file_fail;
+    file_skip  += w.file_skip;
+    file_bytes += w.file_bytes;
+    file_lines += w.file_lines;
+    memo_mismatch += w.memo_mismatch;
+    lazy_mismatch += w.lazy_mismatch;
+    lazy_skip += w.lazy_skip;
+    fused_mismatch += w.fused_mismatch;
+    compact_mismatch += w.compact_mismatch;
+    split_tokens += w.split_tokens;
+    fused_tokens += w.fused_tokens;
+
+    memo_lookups  += w.context.memo.lookups;
+    memo_hits     += w.context.memo.hits;
+    memo_stores   += w.context.memo.stores;
+    memo_replayed += w.context.memo.replayed_nodes;
   }
 
+  // Combined in path order, so it's the same for any number of threads.
+  uint64_t result_hash = 123456789;
+  for (auto h : hashes) result_hash = (result_hash * 373781549) ^ h;
+
   printf("\n");
 
+  // Phase times below are each thread's own CPU time, summed over all
+  // threads. Wall time is the elapsed time for the whole run.
   double total_time = io_time + lex_time + parse_time + cleanup_time;
 
   // 681730869 - 571465032 = Benchmark creates 110M expression wrapper
@@ -233,12 +504,50 @@ int test_parser(int argc, char** argv) {
   printf("Parsing time   %f msec\n", parse_time);
   printf("Cleanup time   %f msec\n", cleanup_time);
   printf("\n");
+  printf("Threads        %d\n", thread_count);
+  printf("Wall time      %f msec\n", wall_time);
+  printf("Wall bytes/sec %f\n", 1000.0 * double(file_bytes) / wall_time);
+  printf("Result hash    0x%016lx\n", result_hash);
+  printf("\n");
+  printf("Memo lookups   %ld\n", memo_lookups);
+  printf("Memo hits      %ld\n", memo_hits);
+  printf("Memo hit rate  %f\n", double(memo_hits) / double(memo_lookups));
+  printf("Memo stores    %ld\n", memo_stores);
+  printf("Memo replayed  %ld nodes\n", memo_replayed);
+  printf("Parsing time without memo %f msec\n", parse_time_nomemo);
+  printf("Memo time saved           %f msec\n", parse_time_nomemo - parse_time);
+  printf("Memo mismatches           %d\n", memo_mismatch);
+  printf("\n");
+  printf("Declarations-only parsing (function bodies deferred)\n");
+  printf("Lazy parse time  %f msec\n", lazy_parse_time);
+  printf("Lazy bytes/sec   %f\n", 1000.0 * double(file_bytes) / lazy_parse_time);
+  printf("Full bytes/sec   %f\n", 1000.0 * double(file_bytes) / parse_time);
+  printf("Expand time      %f msec\n", expand_time);
+  printf("Lazy mismatches  %d\n", lazy_mismatch);
+  printf("Lazy skipped     %d\n", lazy_skip);
+  printf("\n");
+  printf("Operators lexed one character per token vs. fused\n");
+  printf("Split tokens     %ld\n", split_tokens);
+  printf("Fused tokens     %ld\n", fused_tokens);
+  printf("Split lex time   %f msec\n", lex_time);
+  printf("Fused lex time   %f msec\n", fused_lex_time);
+  printf("Split parse time %f msec\n", parse_time);
+  printf("Fused parse time %f msec\n", fused_parse_time);
+  printf("Fused mismatches %d\n", fused_mismatch);
+  printf("\n");
+  printf("Tree walks before and after compact()\n");
+  printf("Arena walk time          %f msec\n", walk_time);
+  printf("Preorder compact time    %f msec\n", compact_time);
+  printf("Preorder link walk time  %f msec\n", flat_walk_time);
+  printf("Preorder visit walk time %f msec\n", visit_walk_time);
+  printf("Compact mismatches       %d\n", compact_mismatch);
+  printf("\n");
   //printf("Node pool      %d bytes\n", LifoAlloc::inst().max_size);
   printf("File pass      %d\n", file_pass);
   printf("File fail      %d\n", file_fail);
   printf("File skip      %d\n", file_skip);
 
-  if (file_fail) {
+  if (file_fail || memo_mismatch || lazy_mismatch || fused_mismatch || compact_mismatch) {
     utils::set_color(0x008080FF);
     printf("##################\n");
     printf("##     FAIL     ##\n");
@@ -252,11 +561,11 @@ int test_parser(int argc, char** argv) {
     utils::set_color(0);
   }
 
-  return 0;
+  return file_fail || memo_mismatch || lazy_mismatch || fused_mismatch || compact_mismatch ? 1 : 0;
 }
 
 //------------------------------------------------------------------------------
 
-int main(int argc, char** argv) { test_parser(argc, argv); }
+int main(int argc, char** argv) { return test_parser(argc, argv); }
 
 //------------------------------------------------------------------------------
@@ -9,6 +9,7 @@
 
 #include "examples/c_lexer/CLexer.hpp"
 #include "examples/c_parser/CContext.hpp"
+#include "examples/c_parser/CIncremental.hpp"
 #include "examples/c_parser/CNode.hpp"
 #include "examples/c_parser/c_parse_nodes.hpp"
 
@@ -63,9 +64,136 @@ void parse_and_dump(matcher_function<CContext, CToken> parse, std::string source
 
 //------------------------------------------------------------------------------
 
+// Edits the incrementally-parsed buffer and checks that it matches a parse of
+// the edited text from scratch.
+
+void edit_and_compare(CIncrementalParser& inc, size_t offset, size_t old_len, std::string new_text) {
+  inc.edit(offset, old_len, new_text);
+
+  CIncrementalParser fresh;
+  fresh.parse(inc.text);
+
+  std::string inc_dump;
+  std::string fresh_dump;
+  inc.context.debug_dump(inc_dump);
+  fresh.context.debug_dump(fresh_dump);
+
+  assert(inc.parse_ok == fresh.parse_ok);
+  assert(inc.items.size() == fresh.items.size());
+  assert(inc_dump == fresh_dump);
+}
+
+void test_incremental() {
+  std::string source =
+    "typedef int foo;\n"
+    "foo x;\n"
+    "int bar(foo y) { return y * 2; }\n"
+    "struct baz { foo a; };\n"
+    "int z = bar(x);\n";
+
+  CIncrementalParser inc;
+  inc.parse(source);
+  assert(inc.parse_ok);
+  assert(inc.items.size() == 6);  // The struct's trailing ; is an item of its own
+
+  // Inside a function body, only that function gets reparsed.
+  auto offset = inc.text.find("y * 2");
+  edit_and_compare(inc, offset, 1, "yy");
+  assert(!inc.full_parse);
+  assert(inc.reparsed_items == 1);
+
+  edit_and_compare(inc, offset, 2, "y");
+  assert(inc.reparsed_items == 1);
+
+  // Adding tokens shifts everything after the edit.
+  offset = inc.text.find("int z");
+  edit_and_compare(inc, offset, 0, "int w = 1 + 2 + 3;\n");
+
+  // Renaming the typedef changes the meaning of everything using it.
+  offset = inc.text.find("foo;");
+  edit_and_compare(inc, offset, 3, "qux");
+  edit_and_compare(inc, offset, 3, "foo");
+
+  // Splitting and joining tokens.
+  offset = inc.text.find("bar(foo");
+  edit_and_compare(inc, offset + 1, 0, " ");
+  edit_and_compare(inc, offset + 1, 1, "");
+  assert(inc.parse_ok);
+
+  // A declaration's extent depends on the tokens after it. "typedef foo" is a
+  // declaration of its own until the edit turns it into "typedef foo , uint".
+  CIncrementalParser lookahead;
+  lookahead.parse("typedef foo int uint;");
+  edit_and_compare(lookahead, 12, 3, ",");
+  assert(lookahead.parse_ok);
+  assert(lookahead.items.size() == 2);
+}
+
+//------------------------------------------------------------------------------
+// Deferred function bodies should expand to the same tree a full parse makes,
+// including types declared after the function not leaking into it.
+
+void test_lazy_bodies() {
+  std::string source =
+    "typedef int foo;\n"
+    "int bar(foo y) { foo z = y; { baz * w; } return z * 2; }\n"
+    "typedef int baz;\n"
+    "int qux() { baz * x; return 0; }\n"
+    "int quux() { return 1; }\n";
+
+  CLexer lexer;
+  lexer.lex(utils::to_span(source));
+  TokenSpan lexemes = utils::to_span(lexer.tokens);
+
+  CContext full;
+  full.parse(utils::to_span(source), lexemes);
+
+  CContext lazy;
+  lazy.lazy_bodies = true;
+  lazy.parse(utils::to_span(source), lexemes);
+
+  auto body = lazy.top_head->node_next->child<"func_body">();
+  assert(body && body->is_deferred() && !body->child_head);
+  assert(lazy.node_count() < full.node_count());
+
+  // Expanding one body doesn't touch the others.
+  assert(lazy.first_child(body));
+  assert(!body->is_deferred());
+  assert(lazy.top_tail->child<"func_body">()->is_deferred());
+
+  lazy.expand_all();
+
+  std::string full_dump;
+  std::string lazy_dump;
+  full.debug_dump(full_dump);
+  lazy.debug_dump(lazy_dump);
+  assert(full_dump == lazy_dump);
+
+  // A body that doesn't parse stays deferred and says so.
+  std::string bad = "int f() { ) ( }\nint g() { return 0; }\n";
+  lexer.reset();
+  lexer.lex(utils::to_span(bad));
+
+  CContext broken;
+  broken.lazy_bodies = true;
+  broken.parse(utils::to_span(bad), utils::to_span(lexer.tokens));
+  assert(broken.parse_complete);
+
+  auto bad_body = broken.top_head->child<"func_body">();
+  assert(!broken.expand_all());
+  assert(bad_body->is_deferred() && bad_body->expand_failed());
+  assert(!broken.first_child(bad_body));
+  assert(!broken.top_tail->child<"func_body">()->is_deferred());
+}
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char** argv) {
   printf("c_parser_test\n");
 
+  test_incremental();
+  test_lazy_bodies();
+
   std::string source;
   std::string result;
 
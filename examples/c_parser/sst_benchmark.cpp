@@ -0,0 +1,158 @@
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+//------------------------------------------------------------------------------
+// Compares SST's perfect hash lookups against the binary search it used to
+// do, over every table in c_constants.hpp. Each table is queried with all of
+// its entries plus the same number of near misses.
+
+// Example usage:
+// bin/examples/c_parser/sst_benchmark
+
+#include "matcheroni/Utilities.hpp"
+
+#include "examples/SST.hpp"
+#include "examples/c_parser/c_constants.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace matcheroni;
+
+const int reps = 2000;
+
+//------------------------------------------------------------------------------
+// The old SST - binary search for tables bigger than 8 entries, linear scan
+// otherwise. Binary search only works if the table is sorted.
+
+template<const auto& table>
+struct SearchSST;
+
+template<typename T, auto N, const std::array<T, N>& table>
+struct SearchSST<table> {
+
+  constexpr static size_t top_bit(size_t x) {
+    for (int b = 31; b >= 0; b--) {
+      if (x & (size_t(1) << b)) return size_t(1) << b;
+    }
+    return 0;
+  }
+
+  inline static int strcmp_span(const char* a, const char* b, const char* lit) {
+    while (1) {
+      auto ca = a == b ? 0 : *a;
+      auto cb = *lit;
+      if (ca != cb || ca == 0) return ca - cb;
+      a++;
+      lit++;
+    }
+  }
+
+  static const char* match(const char* a, const char* b) {
+    if (!a || *a == 0) return nullptr;
+    size_t bit = top_bit(N);
+    size_t index = 0;
+
+    if (N > 8) {
+      while(1) {
+        size_t new_index = index | bit;
+        if (new_index < N) {
+          auto lit = table[new_index];
+          auto c = strcmp_span(a, b, lit);
+          if (c == 0) return lit;
+          if (c > 0) index = new_index;
+        }
+        if (bit == 0) return nullptr;
+        bit >>= 1;
+      }
+    }
+    else {
+      for (auto lit : table) {
+        if (strcmp_span(a, b, lit) == 0) return lit;
+      }
+    }
+
+    return nullptr;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+template<const auto& table>
+const char* reference_match(const std::string& s) {
+  for (auto lit : table) {
+    if (s == lit) return lit;
+  }
+  return nullptr;
+}
+
+template<typename matcher, const auto& table>
+double time_lookups(const std::vector<std::string>& queries, int& errors) {
+  errors = 0;
+  for (auto& q : queries) {
+    if (matcher::match(q.data(), q.data() + q.size()) != reference_match<table>(q)) errors++;
+  }
+
+  size_t hits = 0;
+  double time = -utils::timestamp_ms();
+  for (int rep = 0; rep < reps; rep++) {
+    for (auto& q : queries) {
+      hits += matcher::match(q.data(), q.data() + q.size()) != nullptr;
+    }
+  }
+  time += utils::timestamp_ms();
+
+  // Keeps the loop from being optimized out.
+  if (hits == size_t(-1)) printf("!");
+  return time * 1e6 / (double(reps) * queries.size());
+}
+
+bool any_errors = false;
+
+template<const auto& table>
+void bench_table(const char* name) {
+  std::vector<std::string> queries;
+  for (auto lit : table) {
+    std::string s = lit;
+    queries.push_back(s);
+    queries.push_back(s.size() > 1 ? s.substr(0, s.size() - 1) : s + "x");
+  }
+
+  int search_errors = 0;
+  int hash_errors = 0;
+  double search_ns = time_lookups<SearchSST<table>, table>(queries, search_errors);
+  double hash_ns   = time_lookups<SST<table>, table>(queries, hash_errors);
+  if (hash_errors) any_errors = true;
+
+  printf("%-20s %7ld %10.2f %10.2f %8.2fx %7d %7d\n",
+         name, table.size(), search_ns, hash_ns, search_ns / hash_ns,
+         search_errors, hash_errors);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  printf("SST lookup benchmark, ns per lookup\n");
+  printf("\n");
+  printf("Table                Entries     Search       Hash  Speedup  SErrs   HErrs\n");
+
+  bench_table<c_keywords>("c_keywords");
+  bench_table<builtin_type_base>("builtin_type_base");
+  bench_table<builtin_type_prefix>("builtin_type_prefix");
+  bench_table<builtin_type_suffix>("builtin_type_suffix");
+  bench_table<qualifiers>("qualifiers");
+  bench_table<binary_operators>("binary_operators");
+  bench_table<stddef_typedefs>("stddef_typedefs");
+  bench_table<stdio_typedefs>("stdio_typedefs");
+  bench_table<stdint_typedefs>("stdint_typedefs");
+
+  printf("\n");
+  printf("Errors are lookups that disagree with a linear scan. Binary search\n");
+  printf("gets unsorted tables wrong, the perfect hash shouldn't.\n");
+
+  return any_errors ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
@@ -8,6 +8,7 @@
 // SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
 // SPDX-License-Identifier: MIT License
 
+#include "json_index.hpp"
 #include "json_matcher.hpp"
 #include "json_parser.hpp"
 #include "matcheroni/Utilities.hpp"
@@ -31,6 +32,15 @@ const int reps = 100;
 
 #define MATCH
 #define PARSE
+#define STREAM
+#define INDEX
+
+// Chunk size for the streaming match, which copies the file into a
+// StreamMatcher a chunk at a time as if it were reading from a pipe.
+const int stream_chunk = 65536;
+
+// Comment this out to load files with utils::read() instead of mapping them.
+#define USE_MMAP
 
 TextSpan match_parens(TextMatchContext& ctx, TextSpan body);
 using parens = Ref<match_parens>;
@@ -48,10 +58,84 @@ struct MyMatcher {
   using parens = Ref<match_parens>;
 };
 
+//------------------------------------------------------------------------------
+// Feeds 'input' through a StreamMatcher a chunk at a time, as if it were being
+// read from a pipe, and returns the number of JSON values in it or -1 if it
+// didn't match. JSON numbers can look up to three characters past their end
+// ("1e+") before deciding they're done.
+
+int stream_json(TextMatchContext& ctx, TextSpan input) {
+  utils::StreamMatcher<Ref<match_json>, 3> stream(stream_chunk);
+  int records = 0;
+  while (1) {
+    TextSpan record;
+    auto status = stream.next(ctx, record);
+    if (status == utils::STREAM_RECORD) {
+      records++;
+      continue;
+    }
+    if (status == utils::STREAM_DONE) return records;
+    if (status == utils::STREAM_FAIL) return -1;
+
+    if (input.is_empty()) {
+      stream.finish();
+    } else {
+      size_t len = std::min(stream.write_room(), size_t(input.len()));
+      memcpy(stream.write_begin(), input.begin, len);
+      stream.commit(len);
+      input = input.advance(len);
+    }
+  }
+}
+
+// Splits a parsed document into a stream of newline-separated JSON values no
+// bigger than max_record (where possible), so we can benchmark NDJSON-sized
+// records made from the same data.
+
+void split_records(JsonNode* node, size_t max_record, std::string& out) {
+  if (node->child_head && (node->tag_is<"member">() || size_t(node->span.len()) > max_record)) {
+    for (auto c = node->child_head; c; c = c->node_next) split_records(c, max_record, out);
+  } else {
+    out.append(node->span.begin, node->span.end);
+    out.push_back('\n');
+  }
+}
+
+// Same hash as utils::hash_tree() for a tape, where children are the
+// records inside the parent's subtree.
+
+uint64_t hash_tape(JsonTapeContext& ctx, parseroni::TapeCursor cursor, int depth = 0) {
+  uint64_t h = 1 + depth * 0x87654321;
+  for (auto c = cursor->match_tag(); *c; c++) {
+    h = (h * 975313579) ^ *c;
+  }
+  auto span = ctx.span(cursor.rec);
+  for (auto c = span.begin; c < span.end; c++) {
+    h = (h * 123456789) ^ *c;
+  }
+  for (auto c = cursor.children(); c; c.next()) {
+    h = (h * 987654321) ^ hash_tape(ctx, c, depth + 1);
+  }
+  return h;
+}
+
+uint64_t hash_tape(JsonTapeContext& ctx) {
+  uint64_t h = 123456789;
+  for (auto c = ctx.top(); c; c.next()) {
+    h = (h * 373781549) ^ hash_tape(ctx, c);
+  }
+  return h;
+}
+
 //------------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
   printf("Matcheroni JSON matching/parsing benchmark\n");
+#ifdef MATCHERONI_SIMD
+  printf("SIMD atom scanning enabled (%d-byte vectors)\n", simd::width);
+#else
+  printf("SIMD atom scanning disabled\n");
+#endif
 
   const char* paths[] = {
     // should be 4609770 bytes
@@ -65,30 +149,58 @@ int main(int argc, char** argv) {
   double all_line_accum = 0;
   double all_match_time = 0;
   double all_parse_time = 0;
+  double all_compact_time = 0;
+  double all_tape_time = 0;
+  double all_walk_time = 0;
+  double all_flat_walk_time = 0;
+  double all_visit_walk_time = 0;
+  double all_tree_bytes = 0;
+  double all_compact_bytes = 0;
+  double all_tape_bytes = 0;
+  double all_stream_time = 0;
+  double all_index_time = 0;
+  double all_ndjson_time = 0;
+  double all_ndjson_accum = 0;
 
   TextMatchContext ctx1;
   JsonContext ctx2;
+  JsonCompactContext ctx3;
+  JsonTapeContext ctx4;
+  JsonIndex index;
 
   for (auto path : paths) {
     double byte_accum = 0;
     double line_accum = 0;
     double match_time = 0;
     double parse_time = 0;
+    double compact_time = 0;
+    double tape_time = 0;
+    double walk_time = 0;
+    double flat_walk_time = 0;
+    double visit_walk_time = 0;
+    double stream_time = 0;
+    double index_time = 0;
+    double ndjson_time = 0;
+    double ndjson_accum = 0;
 
     printf("----------------------------------------\n");
     printf("Parsing %s\n", path);
 
+#ifdef USE_MMAP
+    utils::MappedFile file(path);
+    TextSpan text = file.span();
+#else
     std::string buf;
     utils::read(path, buf);
-    if (buf.size() == 0) {
+    TextSpan text = utils::to_span(buf);
+#endif
+    if (text.len() == 0) {
       printf("Could not load %s\n", path);
       continue;
     }
 
-    byte_accum += buf.size();
-    for (size_t i = 0; i < buf.size(); i++) if (buf[i] == '\n') line_accum++;
-
-    TextSpan text = utils::to_span(buf);
+    byte_accum += text.len();
+    for (auto c = text.begin; c < text.end; c++) if (*c == '\n') line_accum++;
 
     //----------------------------------------
 
@@ -117,6 +229,33 @@ int main(int argc, char** argv) {
     }
 #endif
 
+    //----------------------------------------
+    // Stage 1 structural index plus the stage 2 grammar over it.
+
+    TextSpan index_end = text;
+    std::vector<double> index_times;
+    index_times.reserve(reps);
+    for (int rep = 0; rep < reps; rep++) {
+      double time = -utils::timestamp_ms();
+#ifdef INDEX
+      index_end = match_json_indexed(index, text);
+#endif
+      time += utils::timestamp_ms();
+      index_times.push_back(time);
+    }
+    std::sort(index_times.begin(), index_times.end());
+    index_time += index_times[reps/2];
+
+#ifdef INDEX
+    if (index_end.begin < text.end) {
+      printf("Indexed match failed!\n");
+      printf("Failure near `");
+      printf("%50.50s", index_end.end);
+      printf("`\n");
+      exit(-1);
+    }
+#endif
+
     //----------------------------------------
 
     TextSpan parse_end = text;
@@ -144,6 +283,105 @@ int main(int argc, char** argv) {
     }
 #endif
 
+    //----------------------------------------
+    // The same parse into 24-byte compact nodes.
+
+    TextSpan compact_end = text;
+    std::vector<double> compact_times;
+    compact_times.reserve(reps);
+    for (int rep = 0; rep < reps; rep++) {
+      double time = -utils::timestamp_ms();
+      ctx3.reset(text);
+#ifdef PARSE
+      compact_end = parse_json(ctx3, text);
+#endif
+      time += utils::timestamp_ms();
+      compact_times.push_back(time);
+    }
+    std::sort(compact_times.begin(), compact_times.end());
+    compact_time += compact_times[reps/2];
+
+#ifdef PARSE
+    if (compact_end.begin < text.end) {
+      printf("Compact parse failed!\n");
+      exit(-1);
+    }
+    if (ctx3.node_count() != ctx2.node_count() ||
+        utils::hash_compact(ctx3) != utils::hash_context(ctx2)) {
+      printf("Compact tree doesn't match the parse tree!\n");
+      exit(-1);
+    }
+#endif
+
+    //----------------------------------------
+    // The same parse onto a flat tape, no tree links at all.
+
+    TextSpan tape_end = text;
+    std::vector<double> tape_times;
+    tape_times.reserve(reps);
+    for (int rep = 0; rep < reps; rep++) {
+      double time = -utils::timestamp_ms();
+      ctx4.reset(text);
+#ifdef PARSE
+      tape_end = parse_json(ctx4, text);
+#endif
+      time += utils::timestamp_ms();
+      tape_times.push_back(time);
+    }
+    std::sort(tape_times.begin(), tape_times.end());
+    tape_time += tape_times[reps/2];
+
+#ifdef PARSE
+    if (tape_end.begin < text.end) {
+      printf("Tape parse failed!\n");
+      exit(-1);
+    }
+    if (ctx4.node_count() != ctx2.node_count() ||
+        hash_tape(ctx4) != utils::hash_context(ctx2)) {
+      printf("Tape doesn't match the parse tree!\n");
+      exit(-1);
+    }
+#endif
+
+    //----------------------------------------
+    // Streams the whole file as one record, then the same data split up into
+    // NDJSON-sized records. A record that spans chunks gets rematched from its
+    // start, so the first is the worst case for the streaming matcher.
+
+#if defined(STREAM) && defined(PARSE)
+    std::string ndjson;
+    for (auto n = ctx2.top_head; n; n = n->node_next) split_records(n, 4096, ndjson);
+
+    std::vector<double> stream_times;
+    std::vector<double> ndjson_times;
+    stream_times.reserve(reps);
+    ndjson_times.reserve(reps);
+    int stream_records = 0;
+    int ndjson_records = 0;
+    for (int rep = 0; rep < reps; rep++) {
+      double time = -utils::timestamp_ms();
+      stream_records = stream_json(ctx1, text);
+      time += utils::timestamp_ms();
+      stream_times.push_back(time);
+
+      time = -utils::timestamp_ms();
+      ndjson_records = stream_json(ctx1, utils::to_span(ndjson));
+      time += utils::timestamp_ms();
+      ndjson_times.push_back(time);
+    }
+    std::sort(stream_times.begin(), stream_times.end());
+    std::sort(ndjson_times.begin(), ndjson_times.end());
+    stream_time += stream_times[reps/2];
+    ndjson_time += ndjson_times[reps/2];
+    ndjson_accum += ndjson.size();
+
+    if (stream_records != 1 || ndjson_records <= 0) {
+      printf("Stream match failed!\n");
+      exit(-1);
+    }
+    printf("NDJSON records %d\n", ndjson_records);
+#endif
+
     //----------------------------------------
 
     if (dump_tree) {
@@ -157,21 +395,108 @@ int main(int argc, char** argv) {
       //printf("Sizeof(node) == %ld\n", sizeof(JsonNode));
     }
 
+    //----------------------------------------
+    // Walks the tree where the parser left it, then again after compact()
+    // moves it into one preorder array - once through the node links and once
+    // visiting the array in order. compact() frees the allocator, so this goes
+    // last.
+
+    int tree_bytes = ctx2.alloc.current_size();
+
+#ifdef PARSE
+    uint64_t walk_hash = 0;
+    std::vector<double> walk_times;
+    walk_times.reserve(reps);
+    for (int rep = 0; rep < reps; rep++) {
+      double time = -utils::timestamp_ms();
+      walk_hash = utils::hash_shape(ctx2);
+      time += utils::timestamp_ms();
+      walk_times.push_back(time);
+    }
+    std::sort(walk_times.begin(), walk_times.end());
+    walk_time += walk_times[reps/2];
+
+    if (!ctx2.compact()) {
+      printf("Preorder compact failed!\n");
+      exit(-1);
+    }
+
+    uint64_t flat_hash = 0;
+    uint64_t visit_hash = 0;
+    std::vector<double> flat_walk_times;
+    std::vector<double> visit_walk_times;
+    flat_walk_times.reserve(reps);
+    visit_walk_times.reserve(reps);
+    for (int rep = 0; rep < reps; rep++) {
+      double time = -utils::timestamp_ms();
+      flat_hash = utils::hash_shape(ctx2);
+      time += utils::timestamp_ms();
+      flat_walk_times.push_back(time);
+
+      time = -utils::timestamp_ms();
+      visit_hash = utils::hash_shape_flat(ctx2.flat);
+      time += utils::timestamp_ms();
+      visit_walk_times.push_back(time);
+    }
+    std::sort(flat_walk_times.begin(), flat_walk_times.end());
+    std::sort(visit_walk_times.begin(), visit_walk_times.end());
+    flat_walk_time += flat_walk_times[reps/2];
+    visit_walk_time += visit_walk_times[reps/2];
+
+    if (flat_hash != walk_hash || visit_hash != walk_hash ||
+        utils::hash_flat(ctx2.flat) != utils::hash_context(ctx2) ||
+        utils::hash_context(ctx2) != hash_tape(ctx4)) {
+      printf("Preorder tree doesn't match the parse tree!\n");
+      exit(-1);
+    }
+#endif
+
     printf("\n");
     printf("Tree nodes %ld\n", ctx2.node_count());
+    printf("Tree bytes %d (%.1f per node)\n", tree_bytes,
+           double(tree_bytes) / ctx2.node_count());
+    printf("Compact bytes %ld (%.1f per node)\n", ctx3.tree_bytes(),
+           double(ctx3.tree_bytes()) / ctx3.node_count());
+    printf("Tape bytes %ld (%.1f per node)\n", ctx4.tape_bytes(),
+           double(ctx4.tape_bytes()) / ctx4.node_count());
     printf("Byte total %f\n", byte_accum);
     printf("Line total %f\n", line_accum);
     printf("Match time %f\n", match_time);
     printf("Parse time %f\n", parse_time);
+    printf("Compact time %f\n", compact_time);
+    printf("Tape time %f\n", tape_time);
+    printf("Tree walk time %f\n", walk_time);
+    printf("Preorder link walk time %f\n", flat_walk_time);
+    printf("Preorder visit walk time %f\n", visit_walk_time);
+    printf("Index time %f\n", index_time);
+    printf("Stream time %f\n", stream_time);
+    printf("NDJSON time %f\n", ndjson_time);
     printf("Match byte rate  %f megabytes per second\n", (byte_accum / 1e6) / (match_time / 1e3));
     printf("Match line rate  %f megalines per second\n", (line_accum / 1e6) / (match_time / 1e3));
     printf("Parse byte rate  %f megabytes per second\n", (byte_accum / 1e6) / (parse_time / 1e3));
     printf("Parse line rate  %f megalines per second\n", (line_accum / 1e6) / (parse_time / 1e3));
+    printf("Compact byte rate %f megabytes per second\n", (byte_accum / 1e6) / (compact_time / 1e3));
+    printf("Tape byte rate   %f megabytes per second\n", (byte_accum / 1e6) / (tape_time / 1e3));
+    printf("Index byte rate  %f megabytes per second\n", (byte_accum / 1e6) / (index_time / 1e3));
+    printf("Stream byte rate %f megabytes per second\n", (byte_accum / 1e6) / (stream_time / 1e3));
+    printf("NDJSON byte rate %f megabytes per second\n", (ndjson_accum / 1e6) / (ndjson_time / 1e3));
 
     all_byte_accum += byte_accum;
     all_line_accum += line_accum;
     all_match_time += match_time;
     all_parse_time += parse_time;
+    all_compact_time += compact_time;
+    all_tape_time += tape_time;
+    all_walk_time += walk_time;
+    all_flat_walk_time += flat_walk_time;
+    all_visit_walk_time += visit_walk_time;
+    all_tree_bytes += tree_bytes;
+    all_compact_bytes += ctx3.tree_bytes();
+    all_tape_bytes += ctx4.tape_bytes();
+    all_stream_time += stream_time;
+    all_index_time += index_time;
+    all_ndjson_time += ndjson_time;
+    all_ndjson_accum += ndjson_accum;
   }
 
   printf("----------------------------------------\n");
@@ -181,10 +506,26 @@ int main(int argc, char** argv) {
   printf("Line total %f\n", all_line_accum);
   printf("Match time %f\n", all_match_time);
   printf("Parse time %f\n", all_parse_time);
+  printf("Compact time %f\n", all_compact_time);
+  printf("Tape time %f\n", all_tape_time);
+  printf("Tree walk time %f\n", all_walk_time);
+  printf("Preorder link walk time %f\n", all_flat_walk_time);
+  printf("Preorder visit walk time %f\n", all_visit_walk_time);
+  printf("Tree bytes %f\n", all_tree_bytes);
+  printf("Compact bytes %f\n", all_compact_bytes);
+  printf("Tape bytes %f\n", all_tape_bytes);
+  printf("Index time %f\n", all_index_time);
+  printf("Stream time %f\n", all_stream_time);
+  printf("NDJSON time %f\n", all_ndjson_time);
   printf("Match byte rate  %f megabytes per second\n", (all_byte_accum / 1e6) / (all_match_time / 1e3));
   printf("Match line rate  %f megalines per second\n", (all_line_accum / 1e6) / (all_match_time / 1e3));
   printf("Parse byte rate  %f megabytes per second\n", (all_byte_accum / 1e6) / (all_parse_time / 1e3));
   printf("Parse line rate  %f megalines per second\n", (all_line_accum / 1e6) / (all_parse_time / 1e3));
+  printf("Compact byte rate %f megabytes per second\n", (all_byte_accum / 1e6) / (all_compact_time / 1e3));
+  printf("Tape byte rate   %f megabytes per second\n", (all_byte_accum / 1e6) / (all_tape_time / 1e3));
+  printf("Index byte rate  %f megabytes per second\n", (all_byte_accum / 1e6) / (all_index_time / 1e3));
+  printf("Stream byte rate %f megabytes per second\n", (all_byte_accum / 1e6) / (all_stream_time / 1e3));
+  printf("NDJSON byte rate %f megabytes per second\n", (all_ndjson_accum / 1e6) / (all_ndjson_time / 1e3));
   printf("\n");
 
   return 0;
@@ -7,6 +7,7 @@
 // SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
 // SPDX-License-Identifier: MIT License
 
+#include "json_index.hpp"
 #include "json_matcher.hpp"
 #include "json_parser.hpp"
 #include "matcheroni/Utilities.hpp"
@@ -50,6 +51,19 @@ int main(int argc, char** argv) {
 
   double time;
 
+  // The indexed matcher should accept exactly what the parser accepts.
+  JsonIndex index;
+  int index_mismatch = 0;
+  auto check_index = [&](const std::string& path, TextSpan text, bool parsed) {
+    TextSpan tail = match_json_indexed(index, text);
+    bool indexed = tail.is_valid() && tail.begin == text.end;
+    if (indexed != parsed) {
+      index_mismatch++;
+      printf("\n");
+      printf("INDEX MISMATCH %s\n", path.c_str());
+    }
+  };
+
   int y_pass = 0;
   int y_fail = 0;
 
@@ -65,6 +79,7 @@ int main(int argc, char** argv) {
     time -= utils::timestamp_ms();
     TextSpan tail = parse_json(ctx, text);
     time += utils::timestamp_ms();
+    check_index(path, text, tail.is_valid() && tail.begin == text.end);
 
     if (tail.is_valid() && tail.begin == text.end) {
       y_pass++;
@@ -102,6 +117,7 @@ int main(int argc, char** argv) {
     time -= utils::timestamp_ms();
     TextSpan tail = parse_json(ctx, text);
     time += utils::timestamp_ms();
+    check_index(path, text, tail.is_valid() && tail.begin == text.end);
 
     if (tail.is_valid() && tail.begin == text.end) {
       n_fail++;
@@ -127,6 +143,7 @@ int main(int argc, char** argv) {
     time -=  utils::timestamp_ms();
     TextSpan tail = parse_json(ctx, text);
     time +=  utils::timestamp_ms();
+    check_index(path, text, tail.is_valid() && tail.begin == text.end);
 
     if (tail.is_valid() && tail.begin == text.end) {
       i_pass++;
@@ -144,8 +161,9 @@ int main(int argc, char** argv) {
   printf("Other pass      %d\n", i_pass);
   printf("Other fail      %d\n", i_fail);
   printf("Skipped         %d\n", skipped);
+  printf("Index mismatch  %d\n", index_mismatch);
 
-  return (y_fail || n_fail) ? -1 : 0;
+  return (y_fail || n_fail || index_mismatch) ? -1 : 0;
 }
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,261 @@
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+#include "json_index.hpp"
+
+#include <string.h>
+
+using namespace matcheroni;
+
+//------------------------------------------------------------------------------
+// Stage 1
+
+// The byte classes stage 1 needs. The SIMD path uses their match_lanes(), the
+// scalar path their match_byte(), so both classify bytes identically.
+using quote_class  = Atom<'"'>;
+using slash_class  = Atom<'\\'>;
+using op_class     = Atom<'{', '}', '[', ']', ':', ','>;
+using space_class  = Atom<' ', '\n', '\r', '\t'>;
+using ctrl_class   = Range<0x00, 0x1F>;
+using escape_class = Atom<'"', '\\', '/', 'b', 'f', 'n', 'r', 't', 'u'>;
+using u_class      = Atom<'u'>;
+using hex_class    = Range<'0', '9', 'a', 'f', 'A', 'F'>;
+
+struct BlockMasks {
+  uint64_t quote = 0;
+  uint64_t slash = 0;
+  uint64_t op    = 0;
+  uint64_t space = 0;
+  uint64_t ctrl  = 0;
+};
+
+template <typename P>
+inline uint64_t block_mask(const char* block) {
+#ifdef MATCHERONI_SIMD
+  uint64_t hits = 0;
+  for (int i = 0; i < 64; i += simd::width) {
+    hits |= simd::mask(P::match_lanes(simd::load(block + i))) << i;
+  }
+  return hits;
+#else
+  uint64_t hits = 0;
+  for (int i = 0; i < 64; i++) {
+    if (P::match_byte((unsigned char)block[i])) hits |= uint64_t(1) << i;
+  }
+  return hits;
+#endif
+}
+
+inline void classify(const char* block, BlockMasks& m) {
+  m.quote = block_mask<quote_class>(block);
+  m.slash = block_mask<slash_class>(block);
+  m.op    = block_mask<op_class>(block);
+  m.space = block_mask<space_class>(block);
+  m.ctrl  = block_mask<ctrl_class>(block);
+}
+
+// Each bit of the result is the XOR of that bit and all the bits below it, so
+// a mask of quotes turns into a mask of "between an odd and even quote".
+inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// Finds the characters escaped by a backslash - the ones after an odd-length
+// run of backslashes. Runs that start on odd bits and even bits are handled
+// separately, using the carry out of an add to find where each run ends.
+// 'carry' says whether the first character of the next block is escaped.
+inline uint64_t find_escaped(uint64_t slash, uint64_t& carry) {
+  const uint64_t even_bits = 0x5555555555555555ull;
+
+  slash &= ~carry;
+  uint64_t follows_escape = (slash << 1) | carry;
+  uint64_t odd_starts = slash & ~even_bits & ~follows_escape;
+
+  uint64_t even_ends;
+  carry = __builtin_add_overflow(odd_starts, slash, &even_ends);
+  uint64_t invert = even_ends << 1;
+
+  return (even_bits ^ invert) & follows_escape;
+}
+
+bool JsonIndex::build(TextSpan text) {
+  structurals.clear();
+  error = nullptr;
+
+  size_t len = text.len();
+  if (structurals.capacity() < len / 8 + 64) structurals.reserve(len / 8 + 64);
+
+  uint64_t escape_carry = 0;
+  uint64_t in_string_carry = 0;  // All ones if the last block ended in a string
+  uint64_t scalar_carry = 0;     // Top bit set if the last block ended in a scalar
+
+  char pad[64];
+
+  for (size_t base = 0; base < len; base += 64) {
+    // The last partial block gets padded with spaces, which are never
+    // structural.
+    const char* block = text.begin + base;
+    if (len - base < 64) {
+      memset(pad, ' ', 64);
+      memcpy(pad, block, len - base);
+      block = pad;
+    }
+
+    BlockMasks m;
+    classify(block, m);
+
+    uint64_t escaped = find_escaped(m.slash, escape_carry);
+    uint64_t quote = m.quote & ~escaped;
+
+    // Includes each opening quote, excludes each closing quote.
+    uint64_t in_string = prefix_xor(quote) ^ in_string_carry;
+    in_string_carry = uint64_t(int64_t(in_string) >> 63);
+
+    uint64_t string_body = in_string & ~quote;
+    uint64_t bad_string = m.ctrl & string_body;
+
+    // Most blocks have no escapes, so only classify escapes when there are.
+    uint64_t escaped_body = escaped & string_body;
+    if (escaped_body) {
+      bad_string |= escaped_body & ~block_mask<escape_class>(block);
+
+      // \u needs four hex digits after it. Rare enough to check one at a time.
+      for (uint64_t u = escaped_body & block_mask<u_class>(block); u; u &= u - 1) {
+        const char* c = text.begin + base + __builtin_ctzll(u);
+        for (int i = 1; i <= 4; i++) {
+          if (c + i >= text.end || !hex_class::match_byte((unsigned char)c[i])) {
+            error = c;
+            return false;
+          }
+        }
+      }
+    }
+
+    if (bad_string) {
+      error = text.begin + base + __builtin_ctzll(bad_string);
+      return false;
+    }
+
+    // Numbers and keywords are runs of anything that isn't whitespace, an
+    // operator, or part of a string. Only the first byte of a run is indexed.
+    uint64_t scalar = ~(m.space | m.op | quote | in_string);
+    uint64_t scalar_start = scalar & ~((scalar << 1) | (scalar_carry >> 63));
+    scalar_carry = scalar;
+
+    uint64_t hits = (m.op & ~in_string) | (quote & in_string) | scalar_start;
+    if (len - base < 64) hits &= (uint64_t(1) << (len - base)) - 1;
+
+    size_t count = structurals.size();
+    structurals.resize(count + __builtin_popcountll(hits));
+    uint32_t* cursor = structurals.data() + count;
+    for (; hits; hits &= hits - 1) {
+      *cursor++ = uint32_t(base + __builtin_ctzll(hits));
+    }
+  }
+
+  if (in_string_carry) {
+    error = text.end;
+    return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Stage 2
+
+// Atoms are offsets into the text, and compare as the character they point to.
+struct JsonIndexContext {
+  int atom_cmp(uint32_t a, int b) const { return (unsigned char)text[a] - b; }
+  void* checkpoint() { return nullptr; }
+  void rewind(void* /*bookmark*/) {}
+
+  const char* text = nullptr;
+  const char* text_end = nullptr;
+  TextMatchContext text_ctx;
+};
+
+using IndexSpan = Span<uint32_t>;
+
+// Checks a number or keyword with a character-level pattern. The pattern has
+// to cover the whole run of scalar characters, so "12x" and "truex" fail.
+template <typename P>
+struct ScalarText {
+  template <typename context, typename atom>
+  static Span<atom> match(context& ctx, Span<atom> body) {
+    matcheroni_assert(body.is_valid());
+    if (body.is_empty()) return body.fail();
+
+    TextSpan text(ctx.text + *body.begin, ctx.text_end);
+    auto tail = P::match(ctx.text_ctx, text);
+    if (!tail.is_valid()) return body.fail();
+    if (!tail.is_empty()) {
+      unsigned char c = *tail.begin;
+      if (!op_class::match_byte(c) && !space_class::match_byte(c) && c != '"') {
+        return body.fail();
+      }
+    }
+    return body.advance(1);
+  }
+};
+
+struct JsonIndexMatcher {
+  using sign     = Atom<'+', '-'>;
+  using digit    = Range<'0', '9'>;
+  using onenine  = Range<'1', '9'>;
+  using digits   = Some<digit>;
+  using integer  = Seq<Opt<Atom<'-'>>, Oneof<Seq<onenine, digits>, digit>>;
+  using fraction = Seq<Atom<'.'>, digits>;
+  using exponent = Seq<Atom<'e', 'E'>, Opt<sign>, digits>;
+
+  using number  = ScalarText<Seq<integer, Opt<fraction>, Opt<exponent>>>;
+  using keyword = ScalarText<Lits<"true", "false", "null">>;
+
+  // Stage 1 has already checked the whole string, it's one atom here.
+  using string = Atom<'"'>;
+
+  // Whitespace isn't in the index, so there's no Opt<space> anywhere.
+  template <typename P>
+  using list = Seq<P, Any<Seq<Atom<','>, P>>>;
+
+  // The options all start with different characters, so the cheap
+  // single-atom checks can go first.
+  static IndexSpan match_value(JsonIndexContext& ctx, IndexSpan body) {
+    return Oneof<string, array, object, number, keyword>::match(ctx, body);
+  }
+  using value = Ref<match_value>;
+
+  using array  = Seq<Atom<'['>, Opt<list<value>>, Atom<']'>>;
+  using pair   = Seq<string, Atom<':'>, value>;
+  using object = Seq<Atom<'{'>, Opt<list<pair>>, Atom<'}'>>;
+};
+
+//------------------------------------------------------------------------------
+
+__attribute__((noinline))
+TextSpan match_json_indexed(JsonIndex& index, TextSpan body) {
+  if (!index.build(body)) return TextSpan(nullptr, index.error);
+
+  JsonIndexContext ctx;
+  ctx.text = body.begin;
+  ctx.text_end = body.end;
+
+  auto& s = index.structurals;
+  IndexSpan atoms(s.data(), s.data() + s.size());
+  auto tail = JsonIndexMatcher::value::match(ctx, atoms);
+
+  if (!tail.is_valid()) {
+    return TextSpan(nullptr, tail.end < atoms.end ? body.begin + *tail.end : body.end);
+  }
+  if (!tail.is_empty()) {
+    return TextSpan(nullptr, body.begin + *tail.begin);
+  }
+  return TextSpan(body.end, body.end);
+}
+
+//------------------------------------------------------------------------------
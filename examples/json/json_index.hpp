@@ -0,0 +1,28 @@
+#pragma once
+#include "matcheroni/Matcheroni.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+// A structural index for JSON in the style of simdjson. Stage 1 classifies the
+// document 64 bytes at a time into bitmasks of quotes, backslashes, operators
+// and whitespace, works out which bytes are inside strings, and records the
+// offset of every operator, every opening quote, and the first byte of every
+// number or keyword. Stage 2 is a Matcheroni grammar whose atoms are those
+// offsets, so a whole string body is one atom.
+
+// Stage 1 also rejects control characters and bad escapes inside strings, so
+// stage 2 accepts the same documents as match_json().
+
+struct JsonIndex {
+  // Returns false if a string is unterminated or has bad contents, in which
+  // case 'error' points near the problem.
+  bool build(matcheroni::TextSpan text);
+
+  std::vector<uint32_t> structurals;
+  const char* error = nullptr;
+};
+
+// Runs both stages. Same convention as match_json() - on success the tail is
+// empty, on failure the tail's end points near the problem.
+matcheroni::TextSpan match_json_indexed(JsonIndex& index, matcheroni::TextSpan body);
@@ -21,25 +21,24 @@ struct JsonMatcher {
   using space     = Some<Atom<' ', '\n', '\r', '\t'>>;
   using hex       = Range<'0','9','a','f','A','F'>;
   using escape    = Oneof<Charset<"\"\\/bfnrt">, Seq<Atom<'u'>, Rep<4, hex>>>;
-  using character = Oneof<
-    // This is faster
-    //NotAtom<'"', '\\'>,
-    // This is what the spec says
-    Seq<Not<Atom<'"'>>, Not<Atom<'\\'>>, Range<0x0020, 0x10FFFF>>,
-    Seq<Atom<'\\'>, escape>
-  >;
-  using string = Seq<Atom<'"'>, Any<character>, Atom<'"'>>;
+  // This is what the spec says - anything but '"', '\\', or a control
+  // character. It's written as a single Range<> so that Any<> can skip over
+  // runs of unescaped characters in bulk.
+  using unescaped = Range<0x0020, 0x0021, 0x0023, 0x005B, 0x005D, 0x10FFFF>;
+  using escaped   = Seq<Atom<'\\'>, escape>;
+  using string    = Seq<Atom<'"'>, Any<unescaped, escaped>, Atom<'"'>>;
 
   // Matches the three reserved JSON keywords
-  using keyword = Oneof<Lit<"true">, Lit<"false">, Lit<"null">>;
+  using keyword = Lits<"true", "false", "null">;
 
   // Matches a comma-delimited list with embedded whitespace
   template <typename P>
   using list = Seq<P, Any<Seq<Opt<space>, Atom<','>, Opt<space>, P>>>;
 
-  // Matches any valid JSON value
+  // Matches any valid JSON value. Every kind of value starts with a different
+  // set of characters, so Switch<> only ever has to try one of them.
   static TextSpan match_value(TextMatchContext& ctx, TextSpan body) {
-    return Oneof<
+    return Switch<
       number,
       string,
       array,
@@ -7,6 +7,8 @@
 using namespace matcheroni;
 using namespace parseroni;
 
+// The same grammar builds JsonNodes, JsonCompactNodes or a tape of records.
+template <typename context, typename node_type>
 struct JsonParser {
   // Matches any JSON number
   using sign      = Atom<'+', '-'>;
@@ -22,30 +24,29 @@ struct JsonParser {
   using space     = Some<Atom<' ', '\n', '\r', '\t'>>;
   using hex       = Range<'0','9','a','f','A','F'>;
   using escape    = Oneof<Charset<"\"\\/bfnrt">, Seq<Atom<'u'>, Rep<4, hex>>>;
-  using character = Oneof<
-    // This is faster
-    //NotAtom<'"', '\\'>,
-    // This is what the spec says
-    Seq<Not<Atom<'"'>>, Not<Atom<'\\'>>, Range<0x0020, 0x10FFFF>>,
-    Seq<Atom<'\\'>, escape>
-  >;
-  using string = Seq<Atom<'"'>, Any<character>, Atom<'"'>>;
+  // This is what the spec says - anything but '"', '\\', or a control
+  // character. It's written as a single Range<> so that Any<> can skip over
+  // runs of unescaped characters in bulk.
+  using unescaped = Range<0x0020, 0x0021, 0x0023, 0x005B, 0x005D, 0x10FFFF>;
+  using escaped   = Seq<Atom<'\\'>, escape>;
+  using string    = Seq<Atom<'"'>, Any<unescaped, escaped>, Atom<'"'>>;
 
   // Matches the three reserved JSON keywords
-  using keyword = Oneof<Lit<"true">, Lit<"false">, Lit<"null">>;
+  using keyword = Lits<"true", "false", "null">;
 
   // Matches a comma-delimited list with embedded whitespace
   template <typename P>
   using list = Seq<P, Any<Seq<Opt<space>, Atom<','>, Opt<space>, P>>>;
 
-  // Matches any valid JSON value
-  static TextSpan match_value(JsonContext& ctx, TextSpan body) {
-    return Oneof<
-      Capture<"number",  number,  JsonNode>,
-      Capture<"string",  string,  JsonNode>,
-      Capture<"array",   array,   JsonNode>,
-      Capture<"object",  object,  JsonNode>,
-      Capture<"keyword", keyword, JsonNode>
+  // Matches any valid JSON value, only trying the capture that can start with
+  // the next character.
+  static TextSpan match_value(context& ctx, TextSpan body) {
+    return Switch<
+      Capture<"number",  number,  node_type>,
+      Capture<"string",  string,  node_type>,
+      Capture<"array",   array,   node_type>,
+      Capture<"object",  object,  node_type>,
+      Capture<"keyword", keyword, node_type>
     >::match(ctx, body);
   }
   using value = Ref<match_value>;
@@ -63,11 +64,11 @@ struct JsonParser {
   // Matches a key:value pair where 'key' is a string and 'value' is a JSON value.
   using pair =
   Seq<
-    Capture<"key", string, JsonNode>,
+    Capture<"key", string, node_type>,
     Opt<space>,
     Atom<':'>,
     Opt<space>,
-    Capture<"value", value, JsonNode>
+    Capture<"value", value, node_type>
   >;
 
   // Matches a curly-brace-delimited list of key:value pairs.
@@ -75,18 +76,28 @@ struct JsonParser {
   Seq<
     Atom<'{'>,
     Opt<space>,
-    Opt<list<Capture<"member", pair, JsonNode>>>,
+    Opt<list<Capture<"member", pair, node_type>>>,
     Opt<space>,
     Atom<'}'>
   >;
 
   // Matches any valid JSON document
-  static TextSpan match(JsonContext& ctx, TextSpan body) {
+  static TextSpan match(context& ctx, TextSpan body) {
     return Seq<Opt<space>, value, Opt<space>>::match(ctx, body);
   }
 };
 
 __attribute__((noinline))
 TextSpan parse_json(JsonContext& ctx, TextSpan body) {
-  return JsonParser::match(ctx, body);
+  return JsonParser<JsonContext, JsonNode>::match(ctx, body);
+}
+
+__attribute__((noinline))
+TextSpan parse_json(JsonCompactContext& ctx, TextSpan body) {
+  return JsonParser<JsonCompactContext, JsonCompactNode>::match(ctx, body);
+}
+
+__attribute__((noinline))
+TextSpan parse_json(JsonTapeContext& ctx, TextSpan body) {
+  return JsonParser<JsonTapeContext, TapeRecord>::match(ctx, body);
 }
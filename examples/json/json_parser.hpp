@@ -11,7 +11,23 @@ struct JsonNode : public parseroni::NodeBase<JsonNode, char> {
 // Our nodes don't have anything to construct or destruct, so we turn
 // constructors and destructors off during parsing.
 struct JsonContext : public parseroni::NodeContext<JsonNode, false, false> {
-  static int atom_cmp(char a, int b) { return (unsigned char)a - b; }
+  static constexpr auto& atom_cmp = matcheroni::TextMatchContext::atom_cmp;
+};
+
+// The same tree in 24 bytes per node. Call ctx.reset(text) before parsing
+// 'text', as compact spans are offsets into it.
+struct JsonCompactNode : public parseroni::CompactNodeBase<JsonCompactNode, char> {};
+
+struct JsonCompactContext : public parseroni::CompactNodeContext<JsonCompactNode> {
+  static constexpr auto& atom_cmp = matcheroni::TextMatchContext::atom_cmp;
+};
+
+// No tree, just a flat tape of 16-byte records in document order. Also needs
+// ctx.reset(text) before parsing.
+struct JsonTapeContext : public parseroni::TapeContext<char> {
+  static constexpr auto& atom_cmp = matcheroni::TextMatchContext::atom_cmp;
 };
 
 matcheroni::TextSpan parse_json(JsonContext& ctx, matcheroni::TextSpan body);
+matcheroni::TextSpan parse_json(JsonCompactContext& ctx, matcheroni::TextSpan body);
+matcheroni::TextSpan parse_json(JsonTapeContext& ctx, matcheroni::TextSpan body);
@@ -0,0 +1,170 @@
+//------------------------------------------------------------------------------
+// Benchmarks NdjsonParser with 1 to N threads.
+
+// Example usage:
+// bin/examples/json/ndjson_benchmark [max threads] [file.ndjson]
+
+// Without an input file, the JSON files in data/ are split up into records of
+// a few kilobytes each and written out one per line to make the input.
+
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+#include "ndjson_parser.hpp"
+#include "matcheroni/Utilities.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace matcheroni;
+
+const int reps = 10;
+
+// Copies of the data/ files in the generated input.
+const int copies = 4;
+
+//------------------------------------------------------------------------------
+// Copies a JSON value onto one line by dropping the whitespace outside strings.
+
+void append_minified(TextSpan text, std::string& out) {
+  bool in_string = false;
+  for (auto c = text.begin; c < text.end; c++) {
+    if (in_string) {
+      out.push_back(*c);
+      if (*c == '\\') out.push_back(*++c);
+      else if (*c == '"') in_string = false;
+    } else if (*c == '"') {
+      out.push_back(*c);
+      in_string = true;
+    } else if (*c != ' ' && *c != '\n' && *c != '\r' && *c != '\t') {
+      out.push_back(*c);
+    }
+  }
+}
+
+// Writes out a parsed document as NDJSON, splitting values bigger than
+// max_record into their elements where possible.
+
+void split_records(JsonNode* node, size_t max_record, std::string& out) {
+  if (node->child_head && (node->tag_is<"member">() || size_t(node->span.len()) > max_record)) {
+    for (auto c = node->child_head; c; c = c->node_next) split_records(c, max_record, out);
+  } else {
+    append_minified(node->span, out);
+    out.push_back('\n');
+  }
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  printf("Matcheroni NDJSON parsing benchmark\n");
+
+  int max_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+  if (max_threads < 1) max_threads = 1;
+
+  std::string text;
+  if (argc > 2) {
+    utils::read(argv[2], text);
+    if (text.empty()) {
+      printf("Could not load %s\n", argv[2]);
+      return -1;
+    }
+  } else {
+    const char* paths[] = {
+      "data/canada.json",
+      "data/citm_catalog.json",
+      "data/twitter.json",
+      "data/rapidjson_sample.json",
+    };
+
+    std::string records;
+    JsonContext ctx;
+    for (auto path : paths) {
+      utils::MappedFile file(path);
+      if (file.span().len() == 0) {
+        printf("Could not load %s\n", path);
+        continue;
+      }
+      ctx.reset();
+      auto tail = parse_json(ctx, file.span());
+      if (!tail.is_valid() || !tail.is_empty()) {
+        printf("Could not parse %s\n", path);
+        return -1;
+      }
+      for (auto n = ctx.top_head; n; n = n->node_next) split_records(n, 4096, records);
+    }
+    for (int i = 0; i < copies; i++) text += records;
+  }
+
+  TextSpan span = utils::to_span(text);
+  double mbytes = double(text.size()) / 1e6;
+
+  //----------------------------------------
+  // Each thread count gets one untimed run that hashes every record's tree in
+  // order, which should come out the same for any number of threads. The timed
+  // runs only count records.
+
+  size_t record_count = 0;
+  size_t failures = 0;
+  uint64_t hash = 0;
+  auto hash_sink = [&](const NdjsonRecord& record) {
+    hash = hash * 0x9E3779B97F4A7C15ull + (record.root ? utils::hash_tree(record.root) : 0);
+  };
+  auto count_sink = [&](const NdjsonRecord& record) { record_count++; };
+
+  uint64_t first_hash = 0;
+  double first_time = 0;
+  bool hash_mismatch = false;
+
+  printf("----------------------------------------\n");
+  printf("Input          %f megabytes\n", mbytes);
+  printf("\n");
+  printf("Threads  Records/sec     MB/sec      Speedup  Hash\n");
+
+  for (int threads = 1; threads <= max_threads; threads++) {
+    NdjsonParser parser(threads);
+
+    hash = 0;
+    failures = parser.parse(span, hash_sink);
+
+    std::vector<double> times;
+    for (int rep = 0; rep < reps; rep++) {
+      record_count = 0;
+      double time = -utils::wallclock_ms();
+      parser.parse(span, count_sink);
+      time += utils::wallclock_ms();
+      times.push_back(time);
+    }
+    std::sort(times.begin(), times.end());
+    double time = times[reps / 2];
+
+    if (threads == 1) {
+      first_hash = hash;
+      first_time = time;
+    } else if (hash != first_hash) {
+      hash_mismatch = true;
+    }
+
+    printf("%7d  %12.0f  %9.2f  %9.2fx  0x%016lx\n",
+           threads,
+           double(record_count) / (time / 1e3),
+           mbytes / (time / 1e3),
+           first_time / time,
+           hash);
+  }
+
+  printf("\n");
+  printf("Records        %ld\n", record_count);
+  printf("Failures       %ld\n", failures);
+
+  if (hash_mismatch) {
+    printf("Results differ from the single-threaded run!\n");
+  }
+  return failures || hash_mismatch ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
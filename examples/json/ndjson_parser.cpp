@@ -0,0 +1,133 @@
+// SPDX-FileCopyrightText:  2023 Austin Appleby <aappleby@gmail.com>
+// SPDX-License-Identifier: MIT License
+
+#include "ndjson_parser.hpp"
+
+#include <algorithm>
+
+using namespace matcheroni;
+
+// Until<> skips to the next newline with SIMD when it's available.
+using newline_scan = Until<Atom<'\n'>>;
+using blank_line   = Seq<Any<Atom<' ', '\r', '\t'>>, Empty>;
+
+//------------------------------------------------------------------------------
+
+NdjsonParser::NdjsonParser(int thread_count, size_t batch_size, int queue_depth)
+    : batch_size(batch_size ? batch_size : 1),
+      queue_depth(queue_depth > 0 ? queue_depth : 2 * (thread_count > 0 ? thread_count : 1)) {
+  if (thread_count < 1) thread_count = 1;
+  slots = new Slot[this->queue_depth];
+  for (int i = 0; i < thread_count; i++) {
+    threads.emplace_back(&NdjsonParser::run_worker, this);
+  }
+}
+
+NdjsonParser::~NdjsonParser() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  work_cv.notify_all();
+  for (auto& t : threads) t.join();
+  delete[] slots;
+}
+
+//------------------------------------------------------------------------------
+
+size_t NdjsonParser::parse(TextSpan text, const Sink& sink) {
+  TextMatchContext scan;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    batches.clear();
+    next_batch = 0;
+    consumed = 0;
+    for (size_t i = 0; i < queue_depth; i++) slots[i].batch = size_t(-1);
+
+    // Cut a batch every batch_size bytes, pushed forward to the next newline.
+    while (text.begin < text.end) {
+      auto cut = text.begin + std::min(batch_size, size_t(text.len()));
+      if (cut < text.end) {
+        cut = newline_scan::match(scan, TextSpan(cut, text.end)).begin;
+        if (cut < text.end) cut++;
+      }
+      batches.push_back(TextSpan(text.begin, cut));
+      text = TextSpan(cut, text.end);
+    }
+  }
+  work_cv.notify_all();
+
+  size_t failures = 0;
+  for (size_t i = 0; i < batches.size(); i++) {
+    Slot& slot = slots[i % queue_depth];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready_cv.wait(lock, [&] { return slot.batch == i; });
+    }
+
+    for (auto& record : slot.records) sink(record);
+    failures += slot.failures;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      consumed++;
+    }
+    work_cv.notify_all();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  batches.clear();
+  next_batch = 0;
+  return failures;
+}
+
+//------------------------------------------------------------------------------
+// Batch 'i' goes in slot 'i % queue_depth', which is free once the sink has
+// consumed batch 'i - queue_depth'.
+
+void NdjsonParser::run_worker() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (1) {
+    work_cv.wait(lock, [&] {
+      return quit || (next_batch < batches.size() && next_batch < consumed + queue_depth);
+    });
+    if (quit) return;
+
+    size_t i = next_batch++;
+    Slot& slot = slots[i % queue_depth];
+    TextSpan batch = batches[i];
+
+    lock.unlock();
+    parse_batch(slot, batch);
+    lock.lock();
+
+    slot.batch = i;
+    ready_cv.notify_all();
+  }
+}
+
+//------------------------------------------------------------------------------
+
+void NdjsonParser::parse_batch(Slot& slot, TextSpan batch) {
+  TextMatchContext scan;
+
+  slot.ctx.reset();
+  slot.records.clear();
+  slot.failures = 0;
+
+  while (batch.begin < batch.end) {
+    auto eol = newline_scan::match(scan, batch);
+    TextSpan line(batch.begin, eol.begin);
+    batch = eol.is_empty() ? eol : eol.advance(1);
+
+    if (blank_line::match(scan, line).is_valid()) continue;
+
+    auto tail = parse_json(slot.ctx, line);
+    JsonNode* root = tail.is_valid() && tail.is_empty() ? slot.ctx.top_tail : nullptr;
+    if (!root) slot.failures++;
+    slot.records.push_back({line, root});
+  }
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,68 @@
+#pragma once
+#include "json_parser.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Parses newline-delimited JSON (one document per line) on a pool of threads.
+
+// The input is cut into batches of about batch_size bytes at line boundaries.
+// Each batch is parsed into the JsonContext of a slot in a bounded queue, and
+// the sink sees the records in input order. Workers can only get queue_depth
+// batches ahead of the sink, so a slow sink stalls the pool instead of letting
+// parse trees pile up.
+
+// Records (and their trees) passed to the sink are only valid until the sink
+// returns.
+
+struct NdjsonRecord {
+  matcheroni::TextSpan text;  // The line, without its newline
+  JsonNode* root;             // nullptr if the line didn't parse
+};
+
+struct NdjsonParser {
+  using Sink = std::function<void(const NdjsonRecord&)>;
+
+  // queue_depth defaults to two batches per thread.
+  NdjsonParser(int thread_count, size_t batch_size = 256 * 1024, int queue_depth = 0);
+  ~NdjsonParser();
+
+  NdjsonParser(const NdjsonParser&) = delete;
+  NdjsonParser& operator=(const NdjsonParser&) = delete;
+
+  // Returns the number of records that failed to parse. Blank lines are
+  // skipped.
+  size_t parse(matcheroni::TextSpan text, const Sink& sink);
+
+  int thread_count() const { return int(threads.size()); }
+
+  //----------------------------------------
+
+  struct Slot {
+    JsonContext ctx;
+    std::vector<NdjsonRecord> records;
+    size_t failures = 0;
+    size_t batch = size_t(-1);  // Which batch this slot holds, once it's parsed
+  };
+
+  void run_worker();
+  static void parse_batch(Slot& slot, matcheroni::TextSpan batch);
+
+  const size_t batch_size;
+  const size_t queue_depth;
+
+  std::vector<std::thread> threads;
+  Slot* slots = nullptr;
+
+  // Everything below is guarded by 'mutex'.
+  std::mutex mutex;
+  std::condition_variable work_cv;   // Batch available or slot freed up
+  std::condition_variable ready_cv;  // Batch parsed
+  std::vector<matcheroni::TextSpan> batches;
+  size_t next_batch = 0;
+  size_t consumed = 0;
+  bool quit = false;
+};
@@ -397,6 +397,9 @@ void benchmark_srell(const char* path) {
 
 int main(int argc, char** argv) {
   printf("Regex benchmark shootout\n");
+#ifdef MATCHERONI_SIMD
+  printf("Matcheroni SIMD atom scanning enabled (%d-byte vectors)\n", simd::width);
+#endif
 
   const char* path = nullptr;
   if (argc > 1) path = argv[1];
@@ -37,7 +37,7 @@ Seq<
 using string  = Oneof<raw_string, cooked_string, single_string>;
 
 using number  = Some<Range<'0','9','_','_'>>;
-using boolean = Oneof<Lit<"true">, Lit<"false">>;
+using boolean = Lits<"true", "false">;
 using key     = Some<Range<'0','9','a','z','A','Z','_','_','-','-'>>;
 // using date = ???
 
@@ -10,6 +10,11 @@ namespace cookbook {
 template<typename sink>
 using to_lines = Any<Seq<Dispatch<Until<Atom<'\n'>>, sink>, Opt<Atom<'\n'>>>>;
 
+// One line including its newline, for use as a record pattern with
+// utils::StreamMatcher. The last line of a stream may not have a newline.
+
+using line = Seq<Until<Atom<'\n'>>, Opt<Atom<'\n'>>>;
+
 //----------------------------------------
 // Character types from ctype.h
 
@@ -14,6 +14,12 @@
 #define matcheroni_assert(A)
 
 #include <assert.h>
+#include <stdint.h>
+
+#if !defined(MATCHERONI_NO_SIMD) && defined(__SSE2__)
+#define MATCHERONI_SIMD
+#include <immintrin.h>
+#endif
 
 namespace matcheroni {
 
@@ -142,6 +148,256 @@ struct TextMatchContext {
 
 using TextSpan = Span<char>;
 
+//------------------------------------------------------------------------------
+// Contexts that compare characters exactly the way TextMatchContext does can
+// use the fast paths below. Parse contexts that want them can alias the
+// default comparator instead of writing their own:
+//
+// static constexpr auto& atom_cmp = TextMatchContext::atom_cmp;
+
+template <typename context, typename atom>
+constexpr bool uses_text_atom_cmp = false;
+
+template <typename context>
+constexpr bool uses_text_atom_cmp<context, char> = requires {
+  requires static_cast<int (*)(char, int)>(&context::atom_cmp) ==
+           &TextMatchContext::atom_cmp;
+};
+
+//------------------------------------------------------------------------------
+// Repeating a single-atom class (Atom, NotAtom, Range, NotRange, Charset)
+// inside Any<>, Some<> or Until<> normally costs one full trip through the
+// matcher per atom. For text we can instead test 16 or 32 characters at once
+// with SSE2/AVX2 compares and skip the whole run, leaving whatever is left at
+// the end of the span to the scalar matchers.
+
+// Define MATCHERONI_NO_SIMD to turn this off and compare against the plain
+// scalar matchers.
+
+#ifdef MATCHERONI_SIMD
+
+namespace simd {
+
+#ifdef __AVX2__
+using vec = __m256i;
+constexpr int width = 32;
+inline vec load(const char* p)  { return _mm256_loadu_si256((const vec*)p); }
+inline vec splat(int c)         { return _mm256_set1_epi8(char(c)); }
+inline vec zero()               { return _mm256_setzero_si256(); }
+inline vec ones()               { return _mm256_set1_epi8(-1); }
+inline vec eq(vec a, vec b)     { return _mm256_cmpeq_epi8(a, b); }
+inline vec or_(vec a, vec b)    { return _mm256_or_si256(a, b); }
+inline vec not_(vec a)          { return _mm256_xor_si256(a, ones()); }
+inline vec sub(vec a, vec b)    { return _mm256_sub_epi8(a, b); }
+inline vec subs_u(vec a, vec b) { return _mm256_subs_epu8(a, b); }
+inline uint64_t mask(vec a)     { return uint32_t(_mm256_movemask_epi8(a)); }
+#else
+using vec = __m128i;
+constexpr int width = 16;
+inline vec load(const char* p)  { return _mm_loadu_si128((const vec*)p); }
+inline vec splat(int c)         { return _mm_set1_epi8(char(c)); }
+inline vec zero()               { return _mm_setzero_si128(); }
+inline vec ones()               { return _mm_set1_epi8(-1); }
+inline vec eq(vec a, vec b)     { return _mm_cmpeq_epi8(a, b); }
+inline vec or_(vec a, vec b)    { return _mm_or_si128(a, b); }
+inline vec not_(vec a)          { return _mm_xor_si128(a, ones()); }
+inline vec sub(vec a, vec b)    { return _mm_sub_epi8(a, b); }
+inline vec subs_u(vec a, vec b) { return _mm_subs_epu8(a, b); }
+inline uint64_t mask(vec a)     { return uint32_t(_mm_movemask_epi8(a)); }
+#endif
+
+// Atom values are compared against unsigned chars, so anything outside
+// [0,255] can never match.
+template <auto C>
+inline vec match_atom(vec v) {
+  if constexpr (int(C) < 0 || int(C) > 255) {
+    return zero();
+  } else {
+    return eq(v, splat(int(C)));
+  }
+}
+
+// Unsigned range check - (v - lo) <= (hi - lo) iff the saturating subtract of
+// the two is zero.
+template <auto RA, auto RB>
+inline vec match_range(vec v) {
+  constexpr int lo = int(RA) < 0 ? 0 : int(RA);
+  constexpr int hi = int(RB) > 255 ? 255 : int(RB);
+  if constexpr (lo > hi) {
+    return zero();
+  } else {
+    return eq(subs_u(sub(v, splat(lo)), splat(hi - lo)), zero());
+  }
+}
+
+// Returns a pointer to the first character in [cursor, end) whose lane in
+// 'lanes' is not set (or is set, if 'invert' is true). Stops early and
+// returns the cursor when fewer than a vector's worth of characters remain.
+template <typename lanes, bool invert = false>
+inline const char* skip(const char* cursor, const char* end) {
+  constexpr uint64_t full = width == 32 ? 0xFFFFFFFFull : 0xFFFFull;
+
+  // 64 characters per iteration...
+  while (end - cursor >= 64) {
+    uint64_t hits = 0;
+    for (int i = 0; i < 64; i += width) {
+      auto m = lanes::match_lanes(load(cursor + i));
+      hits |= mask(invert ? not_(m) : m) << i;
+    }
+    if (~hits) return cursor + __builtin_ctzll(~hits);
+    cursor += 64;
+  }
+
+  // ...then one vector at a time.
+  while (end - cursor >= width) {
+    auto m = lanes::match_lanes(load(cursor));
+    uint64_t hits = mask(invert ? not_(m) : m);
+    if (hits != full) return cursor + __builtin_ctzll(~hits);
+    cursor += width;
+  }
+
+  return cursor;
+}
+
+}  // namespace simd
+
+// Matchers that test exactly one atom against a fixed set of characters
+// expose 'match_lanes'. AtomLanes<> ORs together the lanes of the leading run
+// of such matchers in a pattern list, so Any<A, B, X> can bulk-skip anything
+// that A or B would match before falling back to Oneof<A, B, X>.
+
+template <typename P>
+concept HasLanes = requires(simd::vec v) { P::match_lanes(v); };
+
+template <typename... rest>
+struct AtomLanes {
+  static constexpr int count = 0;
+  static simd::vec match_lanes(simd::vec v) { return simd::zero(); }
+};
+
+template <typename P, typename... rest>
+struct AtomLanes<P, rest...> {
+  static constexpr int count = HasLanes<P> ? 1 + AtomLanes<rest...>::count : 0;
+
+  static simd::vec match_lanes(simd::vec v) {
+    if constexpr (count == 1) {
+      return P::match_lanes(v);
+    } else {
+      return simd::or_(P::match_lanes(v), AtomLanes<rest...>::match_lanes(v));
+    }
+  }
+};
+
+#endif
+
+//------------------------------------------------------------------------------
+// Single-atom classes also expose a constexpr 'match_byte' that says whether
+// they accept a given unsigned character. For text, ByteClass<> folds one or
+// more of them into a 256-bit table at compile time so that a class with many
+// alternatives (Charset<"...">, Range<a,b,c,d,...>, or a Oneof<> of classes)
+// costs a single bit test per character instead of a compare per member.
+
+struct ByteSet {
+  constexpr void set(int c) { bits[c >> 6] |= uint64_t(1) << (c & 63); }
+  constexpr bool test(unsigned char c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+  uint64_t bits[4] = {};
+};
+
+template <typename P>
+concept IsByteClass = requires { P::match_byte(0); };
+
+// Number of byte classes at the start of a pattern list.
+template <typename... rest>
+constexpr int leading_byte_classes = 0;
+
+template <typename P, typename... rest>
+constexpr int leading_byte_classes<P, rest...> =
+    IsByteClass<P> ? 1 + leading_byte_classes<rest...> : 0;
+
+// ByteClass<> accepts anything accepted by the byte classes at the start of
+// its list and ignores everything after them.
+template <typename... rest>
+struct ByteClass {
+  static constexpr bool match_byte(int c) { return false; }
+};
+
+template <typename P, typename... rest>
+struct ByteClass<P, rest...> {
+  static constexpr bool match_byte(int c) {
+    if constexpr (IsByteClass<P>) {
+      return P::match_byte(c) || ByteClass<rest...>::match_byte(c);
+    } else {
+      return false;
+    }
+  }
+
+  static constexpr ByteSet make_table() {
+    ByteSet table;
+    for (int c = 0; c < 256; c++) {
+      if (match_byte(c)) table.set(c);
+    }
+    return table;
+  }
+
+  static Span<char> match(Span<char> body) {
+    static constexpr ByteSet table = make_table();
+    matcheroni_assert(body.is_valid());
+    if (body.is_empty()) return body.fail();
+    return table.test(*body.begin) ? body.advance(1) : body.fail();
+  }
+};
+
+//------------------------------------------------------------------------------
+// A matcher's FIRST set is the set of bytes a match can start with, plus a
+// flag for whether it can match without consuming anything (in which case it
+// might match in front of any byte). Switch<> uses them to skip options that
+// can't match the next byte.
+
+// Byte classes get theirs from match_byte(). Other matchers can provide a
+// static constexpr first_set(), and the combinators below derive theirs from
+// their parts. Anything else, such as a Ref<> to a function, might match
+// anything. FIRST sets only have to be supersets - a byte in the set that
+// can't actually start a match just costs an extra attempt.
+
+struct FirstSet {
+  static constexpr FirstSet all() {
+    FirstSet f;
+    for (int c = 0; c < 256; c++) f.bytes.set(c);
+    f.nullable = true;
+    return f;
+  }
+
+  constexpr FirstSet& operator|=(const FirstSet& b) {
+    for (int i = 0; i < 4; i++) bytes.bits[i] |= b.bytes.bits[i];
+    nullable |= b.nullable;
+    return *this;
+  }
+
+  ByteSet bytes;
+  bool nullable = false;
+};
+
+template <typename P>
+constexpr FirstSet first_set_of() {
+  if constexpr (requires { P::first_set(); }) {
+    return P::first_set();
+  } else if constexpr (IsByteClass<P>) {
+    FirstSet f;
+    f.bytes = ByteClass<P>::make_table();
+    return f;
+  } else {
+    return FirstSet::all();
+  }
+}
+
+// The union of the FIRST sets of a list of options.
+template <typename... rest>
+constexpr FirstSet first_set_union() {
+  FirstSet f;
+  ((f |= first_set_of<rest>()), ...);
+  return f;
+}
+
 //------------------------------------------------------------------------------
 // Matcheroni consists of a base set of matcher functions wrapped in templated
 // structs. Wrapping them this way allows us to compose functions using
@@ -164,6 +420,10 @@ template <auto C, auto... rest>
 struct Atom<C, rest...> {
   template <typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
+    if constexpr (uses_text_atom_cmp<context, atom>) {
+      return ByteClass<Atom>::match(body);
+    }
+
     matcheroni_assert(body.is_valid());
     if (body.is_empty()) return body.fail();
 
@@ -173,6 +433,16 @@ struct Atom<C, rest...> {
       return Atom<rest...>::match(ctx, body);
     }
   }
+
+  static constexpr bool match_byte(int c) {
+    return c == int(C) || Atom<rest...>::match_byte(c);
+  }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::or_(simd::match_atom<C>(v), Atom<rest...>::match_lanes(v));
+  }
+#endif
 };
 
 template <auto C>
@@ -188,6 +458,14 @@ struct Atom<C> {
       return body.fail();
     }
   }
+
+  static constexpr bool match_byte(int c) { return c == int(C); }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::match_atom<C>(v);
+  }
+#endif
 };
 
 //------------------------------------------------------------------------------
@@ -198,6 +476,10 @@ template <auto C, auto... rest>
 struct NotAtom {
   template <typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
+    if constexpr (uses_text_atom_cmp<context, atom>) {
+      return ByteClass<NotAtom>::match(body);
+    }
+
     matcheroni_assert(body.is_valid());
     if (body.is_empty()) return body.fail();
 
@@ -206,6 +488,16 @@ struct NotAtom {
     }
     return NotAtom<rest...>::match(ctx, body);
   }
+
+  static constexpr bool match_byte(int c) {
+    return !Atom<C, rest...>::match_byte(c);
+  }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::not_(Atom<C, rest...>::match_lanes(v));
+  }
+#endif
 };
 
 template <auto C>
@@ -221,6 +513,14 @@ struct NotAtom<C> {
       return body.advance(1);
     }
   }
+
+  static constexpr bool match_byte(int c) { return c != int(C); }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::not_(simd::match_atom<C>(v));
+  }
+#endif
 };
 
 //------------------------------------------------------------------------------
@@ -242,6 +542,10 @@ template <auto RA, decltype(RA) RB, auto... rest>
 struct Range {
   template <typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
+    if constexpr (uses_text_atom_cmp<context, atom>) {
+      return ByteClass<Range>::match(body);
+    }
+
     matcheroni_assert(body.is_valid());
     if (body.is_empty()) return body.fail();
 
@@ -250,6 +554,16 @@ struct Range {
     }
     return Range<rest...>::match(ctx, body);
   }
+
+  static constexpr bool match_byte(int c) {
+    return (c >= int(RA) && c <= int(RB)) || Range<rest...>::match_byte(c);
+  }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::or_(simd::match_range<RA, RB>(v), Range<rest...>::match_lanes(v));
+  }
+#endif
 };
 
 template <auto RA, decltype(RA) RB>
@@ -264,6 +578,14 @@ struct Range<RA, RB> {
     }
     return body.fail();
   }
+
+  static constexpr bool match_byte(int c) { return c >= int(RA) && c <= int(RB); }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::match_range<RA, RB>(v);
+  }
+#endif
 };
 
 //------------------------------------------------------------------------------
@@ -274,6 +596,10 @@ template <auto RA, decltype(RA) RB, auto... rest>
 struct NotRange {
   template <typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
+    if constexpr (uses_text_atom_cmp<context, atom>) {
+      return ByteClass<NotRange>::match(body);
+    }
+
     matcheroni_assert(body.is_valid());
     if (body.is_empty()) return body.fail();
 
@@ -283,6 +609,16 @@ struct NotRange {
 
     return NotRange<rest...>::match(ctx, body);
   }
+
+  static constexpr bool match_byte(int c) {
+    return !Range<RA, RB, rest...>::match_byte(c);
+  }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::not_(Range<RA, RB, rest...>::match_lanes(v));
+  }
+#endif
 };
 
 template <auto RA, decltype(RA) RB>
@@ -298,6 +634,16 @@ struct NotRange<RA, RB> {
 
     return body.advance(1);
   }
+
+  static constexpr bool match_byte(int c) {
+    return !(c >= int(RA) && c <= int(RB));
+  }
+
+#ifdef MATCHERONI_SIMD
+  static simd::vec match_lanes(simd::vec v) {
+    return simd::not_(simd::match_range<RA, RB>(v));
+  }
+#endif
 };
 
 //------------------------------------------------------------------------------
@@ -342,10 +688,124 @@ struct Lit {
   static SpanType match(Context& ctx, SpanType body) {
     return match_lit(ctx, body, lit.str_val, lit.str_len);
   }
+
+  static constexpr FirstSet first_set() {
+    FirstSet f;
+    if (lit.str_len) {
+      f.bytes.set((unsigned char)lit.str_val[0]);
+    } else {
+      f.nullable = true;
+    }
+    return f;
+  }
 };
 
-// FIXME variadic?
+//------------------------------------------------------------------------------
+// 'Lits' matches the longest of a set of string literals in one pass over the
+// input. The literals get folded into a trie at compile time, so instead of
+// rematching from the start for each alternative like Oneof<Lit<...>, ...>
+// does, each atom only has to be compared against the branches of one trie
+// node.
+
+// Note that this is longest-match, not first-match like Oneof - the order of
+// the literals doesn't matter.
+
+// Lits<"<", "<<", "<<=">::match("<<=1") == "1"
+// Lits<"<", "<<", "<<=">::match("<<1") == "1"
+
+struct LitsNode {
+  char    c = 0;
+  bool    terminal = false;
+  int16_t child = -1;    // First child
+  int16_t sibling = -1;  // Next child of the same parent
+};
 
+template <int N>
+struct LitsTrie {
+  constexpr void add(const char* lit, int len) {
+    int node = 0;
+    for (int i = 0; i < len; i++) {
+      int c = nodes[node].child;
+      while (c >= 0 && nodes[c].c != lit[i]) c = nodes[c].sibling;
+      if (c < 0) {
+        c = count++;
+        nodes[c].c = lit[i];
+        nodes[c].sibling = nodes[node].child;
+        nodes[node].child = int16_t(c);
+      }
+      node = c;
+    }
+    nodes[node].terminal = true;
+  }
+
+  LitsNode nodes[N];
+  int count = 1;
+};
+
+template <int N, StringParam... lits>
+constexpr LitsTrie<N> make_lits_trie() {
+  LitsTrie<N> trie;
+  (trie.add(lits.str_val, lits.str_len), ...);
+  return trie;
+}
+
+template <StringParam... lits>
+struct Lits {
+  static_assert(sizeof...(lits) > 0);
+
+  static constexpr int max_nodes = 1 + (lits.str_len + ...);
+  static_assert(max_nodes < INT16_MAX);
+
+  static constexpr LitsTrie<max_nodes> trie = make_lits_trie<max_nodes, lits...>();
+
+  template <typename context, typename atom>
+  static Span<atom> match(context& ctx, Span<atom> body) {
+    matcheroni_assert(body.is_valid());
+    auto cursor = body.begin;
+    auto end = match_node<0>(ctx, cursor, body.end, (const atom*)nullptr);
+
+    // Like Lit, a failed match reports the first atom that didn't match.
+    return end ? Span<atom>(end, body.end) : Span<atom>(nullptr, cursor);
+  }
+
+  static constexpr FirstSet first_set() {
+    FirstSet f;
+    for (int c = trie.nodes[0].child; c >= 0; c = trie.nodes[c].sibling) {
+      f.bytes.set((unsigned char)trie.nodes[c].c);
+    }
+    f.nullable = trie.nodes[0].terminal;
+    return f;
+  }
+
+  // Each trie node is its own instantiation, so the walk compiles down to
+  // nested compares against constants. 'cursor' is left at the first atom
+  // that didn't match, 'best' is the end of the longest literal so far.
+  template <int node, typename context, typename atom>
+  static const atom* match_node(context& ctx, const atom*& cursor, const atom* end,
+                                const atom* best) {
+    if constexpr (trie.nodes[node].terminal) best = cursor;
+    if constexpr (trie.nodes[node].child < 0) {
+      return best;
+    } else {
+      if (cursor == end) return best;
+      return match_child<trie.nodes[node].child>(ctx, cursor, end, best);
+    }
+  }
+
+  template <int child, typename context, typename atom>
+  static const atom* match_child(context& ctx, const atom*& cursor, const atom* end,
+                                 const atom* best) {
+    if (ctx.atom_cmp(*cursor, trie.nodes[child].c) == 0) {
+      cursor++;
+      return match_node<child>(ctx, cursor, end, best);
+    }
+    if constexpr (trie.nodes[child].sibling >= 0) {
+      return match_child<trie.nodes[child].sibling>(ctx, cursor, end, best);
+    } else {
+      return best;
+    }
+  }
+};
 
 //------------------------------------------------------------------------------
 // 'Seq' (sequence) succeeds if all of its sub-matchers succeed in order.
@@ -361,6 +821,15 @@ struct Seq {
     auto tail = P::match(ctx, body);
     return tail ? Seq<rest...>::match(ctx, tail) : tail;
   }
+
+  static constexpr FirstSet first_set() {
+    auto f = first_set_of<P>();
+    if (f.nullable) {
+      f.nullable = false;
+      f |= first_set_of<Seq<rest...>>();
+    }
+    return f;
+  }
 };
 
 template <typename P>
@@ -370,6 +839,8 @@ struct Seq<P> {
     matcheroni_assert(body.is_valid());
     return P::match(ctx, body);
   }
+
+  static constexpr FirstSet first_set() { return first_set_of<P>(); }
 };
 
 //------------------------------------------------------------------------------
@@ -380,12 +851,25 @@ struct Seq<P> {
 // Oneof<Atom<'a'>, Atom<'b'>>::match("abcd") == "bcd"
 // Oneof<Atom<'a'>, Atom<'b'>>::match("bcde") == "cde"
 
+template <typename... rest>
+struct OneofAfterClasses;
+
 template <typename P, typename... rest>
 struct Oneof {
   template <typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
     matcheroni_assert(body.is_valid());
 
+    // A leading run of single-atom classes collapses into one table lookup.
+    // They all consume exactly one atom and touch no context state, so trying
+    // them together gives the same result as trying them in order.
+    if constexpr (uses_text_atom_cmp<context, atom> &&
+                  leading_byte_classes<P, rest...> >= 2) {
+      auto tail = ByteClass<P, rest...>::match(body);
+      if (tail.is_valid()) return tail;
+      return OneofAfterClasses<rest...>::match(ctx, body);
+    }
+
     auto bookmark = ctx.checkpoint();
 
     auto tail1 = P::match(ctx, body);
@@ -403,6 +887,8 @@ struct Oneof {
       return tail1.end > tail2.end ? tail1 : tail2;
     }
   }
+
+  static constexpr FirstSet first_set() { return first_set_union<P, rest...>(); }
 };
 
 template <typename P>
@@ -412,6 +898,134 @@ struct Oneof<P> {
     matcheroni_assert(body.is_valid());
     return P::match(ctx, body);
   }
+
+  static constexpr FirstSet first_set() { return first_set_of<P>(); }
+};
+
+// Tries the options left over after the byte classes at the start of the list
+// have already failed to match.
+template <typename... rest>
+struct OneofAfterClasses {
+  template <typename context, typename atom>
+  static Span<atom> match(context& ctx, Span<atom> body) {
+    return body.fail();
+  }
+};
+
+template <typename P, typename... rest>
+struct OneofAfterClasses<P, rest...> {
+  template <typename context, typename atom>
+  static Span<atom> match(context& ctx, Span<atom> body) {
+    if constexpr (IsByteClass<P>) {
+      return OneofAfterClasses<rest...>::match(ctx, body);
+    } else {
+      return Oneof<P, rest...>::match(ctx, body);
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+// 'Switch' is Oneof with a jump table. It looks the next byte up in a table
+// built from its options' FIRST sets, and only tries the options that could
+// match text starting with that byte. The ones it tries still go in order, so
+// it returns the same match as Oneof<> would, just faster when there are lots
+// of options that each start with a few different bytes.
+
+// Spans that aren't text, and empty spans, try every option in order.
+
+// Switch<Lit<"foo">, Lit<"bar">>::match("barf") == "f" (without trying "foo")
+
+// match_index() also reports which option matched, so callers can tell what
+// they found without matching it again.
+
+template <typename... rest>
+struct Switch {
+  static_assert(sizeof...(rest) >= 1 && sizeof...(rest) <= 64);
+
+  struct Table {
+    uint64_t masks[256] = {};
+  };
+
+  // Bit 'i' of masks[c] is set if option 'i' could match text starting with
+  // 'c'.
+  static constexpr Table make_table() {
+    Table table;
+    FirstSet firsts[] = {first_set_of<rest>()...};
+    for (int i = 0; i < int(sizeof...(rest)); i++) {
+      for (int c = 0; c < 256; c++) {
+        if (firsts[i].nullable || firsts[i].bytes.test(c)) {
+          table.masks[c] |= uint64_t(1) << i;
+        }
+      }
+    }
+    return table;
+  }
+
+  static constexpr Table table = make_table();
+
+  template <typename context, typename atom>
+  static Span<atom> match(context& ctx, Span<atom> body) {
+    int index;
+    return match_index(ctx, body, index);
+  }
+
+  // 'index' is set to the option that matched, or -1 if nothing did.
+  template <typename context, typename atom>
+  static Span<atom> match_index(context& ctx, Span<atom> body, int& index) {
+    matcheroni_assert(body.is_valid());
+    index = -1;
+    uint64_t mask = ~uint64_t(0);
+    if constexpr (uses_text_atom_cmp<context, atom>) {
+      if (!body.is_empty()) mask = table.masks[(unsigned char)*body.begin];
+    }
+
+    // Same as Oneof, a failed match returns whichever option got farthest.
+    auto result = body.fail();
+    int i = 0;
+    (try_option<rest>(ctx, body, mask, i++, index, result) || ...);
+    return result;
+  }
+
+  template <typename P, typename context, typename atom>
+  static bool try_option(context& ctx, Span<atom> body, uint64_t mask, int i,
+                         int& index, Span<atom>& result) {
+    if (!(mask & (uint64_t(1) << i))) return false;
+
+    auto bookmark = ctx.checkpoint();
+    auto tail = P::match(ctx, body);
+    if (tail.is_valid()) {
+      index = i;
+      result = tail;
+      return true;
+    }
+
+    if (bookmark != ctx.checkpoint()) ctx.rewind(bookmark);
+    if (tail.end > result.end) result = tail;
+    return false;
+  }
+
+  static constexpr FirstSet first_set() { return first_set_union<rest...>(); }
+};
+
+//------------------------------------------------------------------------------
+// 'FirstOf' declares the FIRST set of a matcher that can't work out its own,
+// usually a Ref<> to a function. C is a byte class that accepts every byte a
+// match of P can start with.
+
+// FirstOf<Atom<'#'>, Ref<match_preproc>>
+
+template <typename C, typename P>
+struct FirstOf {
+  template <typename context, typename atom>
+  static Span<atom> match(context& ctx, Span<atom> body) {
+    return P::match(ctx, body);
+  }
+
+  static constexpr FirstSet first_set() {
+    FirstSet f;
+    f.bytes = ByteClass<C>::make_table();
+    return f;
+  }
 };
 
 //------------------------------------------------------------------------------
@@ -433,6 +1047,8 @@ struct One {
   static Span<atom> match(context& ctx, Span<atom> body) {
     return P::match(ctx, body);
   }
+
+  static constexpr FirstSet first_set() { return first_set_of<P>(); }
 };
 
 //------------------------------------------------------------------------------
@@ -451,6 +1067,12 @@ struct Opt {
     if (bookmark != ctx.checkpoint()) ctx.rewind(bookmark);
     return body;
   }
+
+  static constexpr FirstSet first_set() {
+    auto f = first_set_union<rest...>();
+    f.nullable = true;
+    return f;
+  }
 };
 
 //------------------------------------------------------------------------------
@@ -471,6 +1093,12 @@ struct Any {
     if (body.is_empty()) return body;
 
     while (1) {
+#ifdef MATCHERONI_SIMD
+      if constexpr (uses_text_atom_cmp<context, atom> && AtomLanes<rest...>::count) {
+        body.begin = simd::skip<AtomLanes<rest...>>(body.begin, body.end);
+        if (body.is_empty()) break;
+      }
+#endif
       auto bookmark = ctx.checkpoint();
       auto tail = Oneof<rest...>::match(ctx, body);
       if (!tail.is_valid()) {
@@ -483,6 +1111,12 @@ struct Any {
 
     return body;
   }
+
+  static constexpr FirstSet first_set() {
+    auto f = first_set_union<rest...>();
+    f.nullable = true;
+    return f;
+  }
 };
 
 //------------------------------------------------------------------------------
@@ -510,6 +1144,13 @@ struct Some {
     auto tail = Any<rest...>::match(ctx, body);
     return (tail == body) ? body.fail() : tail;
   }
+
+  // Some<> never matches an empty span.
+  static constexpr FirstSet first_set() {
+    auto f = first_set_union<rest...>();
+    f.nullable = false;
+    return f;
+  }
 };
 
 //------------------------------------------------------------------------------
@@ -616,6 +1257,12 @@ struct NotEmpty {
     auto tail = Seq<rest...>::match(ctx, body);
     return tail == body ? body.fail() : tail;
   }
+
+  static constexpr FirstSet first_set() {
+    auto f = first_set_of<Seq<rest...>>();
+    f.nullable = false;
+    return f;
+  }
 };
 
 //------------------------------------------------------------------------------
@@ -667,6 +1314,11 @@ struct Until {
   template<typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
     matcheroni_assert(body.is_valid());
+#ifdef MATCHERONI_SIMD
+    if constexpr (uses_text_atom_cmp<context, atom> && HasLanes<P>) {
+      body.begin = simd::skip<P, true>(body.begin, body.end);
+    }
+#endif
     while(1) {
       if (body.is_empty()) return body;
       auto bookmark = ctx.checkpoint();
@@ -783,12 +1435,13 @@ struct Ref<func> {
 
 // Note that the backreference is stored as a static pointer in the
 // StoreBackref template, so be careful of nesting as you could clobber it.
+// It's thread_local so that separate threads can match independently.
 
 // FIXME this should create a temp node or something like the bookmarks
 
 template <StringParam name, typename atom, typename P>
 struct StoreBackref {
-  inline static Span<atom> ref;
+  inline static thread_local Span<atom> ref;
 
   template<typename context>
   static Span<atom> match(context& ctx, Span<atom> body) {
@@ -945,7 +1598,12 @@ template <StringParam chars>
 struct Charset {
   template <typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
+    if constexpr (uses_text_atom_cmp<context, atom>) {
+      return ByteClass<Charset>::match(body);
+    }
+
     matcheroni_assert(body.is_valid());
+    if (body.is_empty()) return body.fail();
 
     for (auto i = 0; i < chars.str_len; i++) {
       if (ctx.atom_cmp(body.begin[0], chars.str_val[i]) == 0) {
@@ -954,6 +1612,25 @@ struct Charset {
     }
     return body.fail();
   }
+
+  static constexpr bool match_byte(int c) {
+    for (auto i = 0; i < chars.str_len; i++) {
+      if (int(chars.str_val[i]) == c) return true;
+    }
+    return false;
+  }
+
+#ifdef MATCHERONI_SIMD
+  // Negative chars in the set never match, same as in atom_cmp() above.
+  static simd::vec match_lanes(simd::vec v) {
+    auto result = simd::zero();
+    for (auto i = 0; i < chars.str_len; i++) {
+      if (chars.str_val[i] < 0) continue;
+      result = simd::or_(result, simd::eq(v, simd::splat(chars.str_val[i])));
+    }
+    return result;
+  }
+#endif
 };
 
 //------------------------------------------------------------------------------
@@ -3,6 +3,9 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <mutex>
+#include <type_traits>
+#include <vector>
 
 #include "matcheroni/Matcheroni.hpp"
 
@@ -11,9 +14,10 @@ namespace parseroni {
 using namespace matcheroni;
 
 //------------------------------------------------------------------------------
-// This is an optimized allocator for Parseroni - it allows for alloc/free, but
-// frees must be in LIFO order - if you allocate A, B, and C, you must
-// deallocate in C-B-A order.
+// This is an optimized allocator for Parseroni - a stack of slabs. Nothing is
+// freed on its own, instead everything allocated after a mark() gets freed at
+// once by rewinding to it. Allocations carry no header or footer, so anything
+// that needs to walk them has to know their sizes.
 
 struct LifoAlloc {
   struct Slab {
@@ -29,7 +33,6 @@ struct LifoAlloc {
   // Default slab size is 2 megs = 1 hugepage. Seems to work ok.
   static constexpr int header_size = sizeof(Slab);
   static constexpr int slab_size = 2 * 1024 * 1024 - header_size;
-  static constexpr int alloc_overhead = 8;
 
   LifoAlloc() {
     add_slab();
@@ -69,28 +72,15 @@ struct LifoAlloc {
   }
 
   void* alloc(int alloc_size) {
-    if (top_slab->size() + alloc_size + alloc_overhead > slab_size) {
+    if (top_slab->size() + alloc_size > slab_size) {
       add_slab();
     }
 
     auto result = top_slab->cursor;
     top_slab->cursor += alloc_size;
-    *(uint64_t*)(top_slab->cursor) = alloc_size;
-    top_slab->cursor += alloc_overhead;
-
     return result;
   }
 
-  void free(void* p) {
-    top_slab->cursor -= alloc_overhead;
-    uint64_t alloc_size = *(uint64_t*)top_slab->cursor;
-    top_slab->cursor -= alloc_size;
-
-    if (top_slab->size() == 0 && top_slab->prev) {
-      top_slab = top_slab->prev;
-    }
-  }
-
   int current_size() const {
     auto slab = top_slab;
     while (slab->prev) slab = slab->prev;
@@ -105,9 +95,74 @@ struct LifoAlloc {
     return top_slab->prev == nullptr && top_slab->size() == 0;
   }
 
+  // A mark records the top of the stack.
+  struct Mark {
+    Slab* slab;
+    char* cursor;
+  };
+
+  Mark mark() const { return {top_slab, top_slab->cursor}; }
+
+  // Frees everything allocated after 'm' at once. Slabs above the mark's get
+  // emptied so add_slab() can hand them out again.
+  void rewind(Mark m) {
+    for (auto slab = top_slab; slab != m.slab; slab = slab->prev) slab->clear();
+    top_slab = m.slab;
+    top_slab->cursor = m.cursor;
+  }
+
+  // Empties the allocator and gives back every slab but the first.
+  void release() {
+    reset();
+    auto c = top_slab->next;
+    while (c) {
+      auto next = c->next;
+      ::free((void*)c);
+      c = next;
+    }
+    top_slab->next = nullptr;
+  }
+
   Slab* top_slab = nullptr;
 };
 
+//------------------------------------------------------------------------------
+// Every capture tag gets interned into a small integer id the first time the
+// capture runs, so tree walkers can compare ids instead of calling strcmp on
+// tag names. Ids never change after that, tags with the same name get the
+// same id no matter which capture they came from, and TagTable::name() maps
+// ids back to names for dumps.
+
+struct TagTable {
+  static uint16_t intern(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex());
+    for (int i = 0; i < count(); i++) {
+      if (strcmp(names()[i], name) == 0) return uint16_t(i);
+    }
+    matcheroni_assert(count() < 65536);
+    names()[count()] = name;
+    return uint16_t(count()++);
+  }
+
+  static const char* name(uint16_t id) {
+    return names()[id];
+  }
+
+  static std::mutex& mutex() { static std::mutex m; return m; }
+  static int& count() { static int c = 0; return c; }
+  static const char** names() { static const char* n[65536]; return n; }
+};
+
+// The id for a tag known at compile time. The lookup happens once per tag,
+// after that this is a load and a predictable branch.
+template<StringParam match_tag>
+struct TagId {
+  static uint16_t get() {
+    static const uint16_t id = TagTable::intern(match_tag.str_val);
+    return id;
+  }
+};
+
 //------------------------------------------------------------------------------
 
 template<typename NodeType, typename AtomType>
@@ -129,6 +184,15 @@ struct NodeBase {
     return nullptr;
   }
 
+  template<StringParam name>
+  NodeType* child() {
+    auto id = TagId<name>::get();
+    for (auto c = child_head; c; c = c->node_next) {
+      if (c->tag_id == id) return c;
+    }
+    return nullptr;
+  }
+
   size_t node_count() {
     size_t accum = 1;
     for (auto c = child_head; c; c = c->node_next) accum += c->node_count();
@@ -139,11 +203,18 @@ struct NodeBase {
     return strcmp(match_tag, name) == 0;
   }
 
+  template<StringParam name>
+  bool tag_is() const {
+    return tag_id == TagId<name>::get();
+  }
+
   //----------------------------------------
 
   const char* match_tag;
   SpanType    span;
-  uint64_t    flags;
+  uint32_t    flags;
+  uint16_t    tag_id;   // Set by the context after init()
+  uint16_t    node_size;  // sizeof() the node's actual type, also set by the context
 
   NodeType*   node_parent;
   NodeType*   node_prev;
@@ -152,6 +223,154 @@ struct NodeBase {
   NodeType*   child_tail;
 };
 
+//------------------------------------------------------------------------------
+// A finished tree, copied into one array in preorder by NodeContext::compact().
+// The copies keep their usual links, pointed at each other, and 'links' has
+// the same structure as array indices - a node's subtree is the nodes from it
+// up to 'subtree_end', and its first child comes right after it.
+
+template<typename NodeType>
+struct PreorderTree {
+  static constexpr uint32_t none = UINT32_MAX;
+
+  struct Links {
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t subtree_end;
+    uint32_t depth;
+  };
+
+  // Walks a node and the siblings after it.
+  struct Siblings {
+    struct iterator {
+      NodeType& operator*() const { return nodes[index]; }
+      NodeType* operator->() const { return nodes + index; }
+      iterator& operator++() { index = links[index].next_sibling; return *this; }
+      bool operator!=(const iterator& b) const { return index != b.index; }
+
+      NodeType* nodes;
+      const Links* links;
+      uint32_t index;
+    };
+
+    iterator begin() const { return {nodes, links, first}; }
+    iterator end() const { return {nodes, links, none}; }
+
+    NodeType* nodes;
+    const Links* links;
+    uint32_t first;
+  };
+
+  PreorderTree() {}
+  PreorderTree(const PreorderTree&) = delete;
+  PreorderTree& operator=(const PreorderTree&) = delete;
+
+  ~PreorderTree() {
+    ::free(nodes);
+    ::free(links);
+  }
+
+  void clear() {
+    count = 0;
+  }
+
+  //----------------------------------------
+
+  NodeType* begin() const { return nodes; }
+  NodeType* end() const { return nodes + count; }
+
+  uint32_t index(const NodeType* n) const {
+    return uint32_t(n - nodes);
+  }
+
+  Siblings roots() const {
+    return {nodes, links, count ? 0 : none};
+  }
+
+  Siblings children(uint32_t i) const {
+    return {nodes, links, links[i].first_child};
+  }
+
+  // Calls v(node, depth) on every node, in preorder.
+  template<typename V>
+  void visit(V&& v) const {
+    for (uint32_t i = 0; i < count; i++) v(nodes[i], int(links[i].depth));
+  }
+
+  //----------------------------------------
+  // Copies the list of trees starting at 'head'. Nodes are copied as NodeType,
+  // so this fails if any of them is a bigger derived type.
+
+  bool assign(NodeType* head) {
+    size_t total = 0;
+    for (auto n = head; n; n = n->node_next) {
+      if (!count_nodes(n, total)) return false;
+    }
+    matcheroni_assert(total < none);
+
+    if (total > cap) {
+      cap = uint32_t(total);
+      nodes = (NodeType*)realloc((void*)nodes, cap * sizeof(NodeType));
+      links = (Links*)realloc((void*)links, cap * sizeof(Links));
+    }
+
+    count = 0;
+    copy_siblings(head, nullptr, 0);
+    return true;
+  }
+
+  //----------------------------------------
+
+  NodeType* nodes = nullptr;
+  Links*    links = nullptr;
+  uint32_t  count = 0;
+  uint32_t  cap = 0;
+
+ private:
+
+  static bool count_nodes(NodeType* n, size_t& total) {
+    if (n->node_size != sizeof(NodeType)) return false;
+    total++;
+    for (auto c = n->child_head; c; c = c->node_next) {
+      if (!count_nodes(c, total)) return false;
+    }
+    return true;
+  }
+
+  // Returns the index of the first copy, or 'none' if 'head' is null.
+  uint32_t copy_siblings(NodeType* head, NodeType* parent, uint32_t depth) {
+    uint32_t first = none;
+    uint32_t prev = none;
+    for (auto src = head; src; src = src->node_next) {
+      uint32_t i = count++;
+      auto dst = nodes + i;
+      memcpy((void*)dst, src, sizeof(NodeType));
+      dst->node_parent = parent;
+      dst->node_next = nullptr;
+
+      if (prev == none) {
+        first = i;
+        dst->node_prev = nullptr;
+      } else {
+        links[prev].next_sibling = i;
+        nodes[prev].node_next = dst;
+        dst->node_prev = nodes + prev;
+      }
+
+      links[i].first_child = copy_siblings(src->child_head, dst, depth + 1);
+      links[i].next_sibling = none;
+      links[i].subtree_end = count;
+      links[i].depth = depth;
+      dst->child_head = links[i].first_child == none ? nullptr : nodes + links[i].first_child;
+      prev = i;
+    }
+
+    // The last sibling is the parent's tail.
+    if (parent) parent->child_tail = prev == none ? nullptr : nodes + prev;
+    return first;
+  }
+};
+
 //------------------------------------------------------------------------------
 
 template<typename _NodeType, bool _call_constructors = true, bool _call_destructors = true>
@@ -174,22 +393,29 @@ struct NodeContext {
   }
 
   void reset() {
-    // Call destructors for all the nodes in the allocator.
-    if (call_destructors) {
-      for (auto slab = alloc.top_slab; slab; slab = slab->prev) {
-        while(slab->cursor > slab->buf) {
-          slab->cursor -= LifoAlloc::alloc_overhead;
-          int alloc_size = *(uint64_t*)slab->cursor;
-          slab->cursor -= alloc_size;
-          NodeType* node = (NodeType*)slab->cursor;
-          node->~NodeType();
-        }
-      }
-    }
-
+    destroy_nodes(0);
     top_head = nullptr;
     top_tail = nullptr;
     alloc.reset();
+    flat.clear();
+  }
+
+  //----------------------------------------
+  // Moves the finished tree into 'flat' and frees the allocator. top_head and
+  // top_tail point into 'flat' afterwards, so anything that walks the tree
+  // through its links keeps working. Returns false and leaves the tree where
+  // it is if a node can't be copied as a NodeType. Don't parse anything else
+  // into the context before the next reset().
+
+  bool compact() {
+    static_assert(!call_destructors && std::is_trivially_copyable_v<NodeType>);
+    if (!flat.assign(top_head)) return false;
+
+    top_head = flat.count ? flat.nodes : nullptr;
+    top_tail = top_head;
+    while (top_tail && top_tail->node_next) top_tail = top_tail->node_next;
+    alloc.release();
+    return true;
   }
 
   //----------------------------------------
@@ -239,7 +465,7 @@ struct NodeContext {
     new_node->child_tail = child_tail;
 
     if (child_head->node_prev) child_head->node_prev->node_next = new_node;
-    if (child_tail->node_next) child_head->node_next->node_prev = new_node;
+    if (child_tail->node_next) child_tail->node_next->node_prev = new_node;
 
     child_head->node_prev = nullptr;
     child_tail->node_next = nullptr;
@@ -250,22 +476,81 @@ struct NodeContext {
     if (top_tail == child_tail) top_tail = new_node;
   }
 
+  //----------------------------------------
+  // Captures create their nodes through the context, so contexts with other
+  // node layouts can fill them in their own way.
+
+  template<typename node_type, StringParam match_tag>
+  node_type* create_node(SpanType span, uint64_t flags, NodeType* old_tail) {
+    static_assert(sizeof(node_type) <= UINT16_MAX);
+    node_type* new_node = (node_type*)alloc.alloc(sizeof(node_type));
+    if (call_constructors) {
+      new (new_node) node_type();
+    }
+    if constexpr (call_destructors && !std::is_trivially_destructible_v<node_type>) {
+      dtor_nodes.push_back({new_node, destroy<node_type>});
+    }
+    merge_node(new_node, old_tail);
+    new_node->init(match_tag.str_val, span, flags);
+    new_node->tag_id = TagId<match_tag>::get();
+    new_node->node_size = sizeof(node_type);
+    return new_node;
+  }
+
+  //----------------------------------------
+  // Nodes that need their destructors called get recorded in 'dtor_nodes' as
+  // they're created, so freeing nodes only has to visit those. For node types
+  // with trivial destructors it stays empty.
+
+  struct DtorEntry {
+    NodeType* node;
+    void (*destroy)(NodeType*);
+  };
+
+  template<typename node_type>
+  static void destroy(NodeType* node) {
+    static_cast<node_type*>(node)->~node_type();
+  }
+
+  // Destroys the nodes created after the first 'keep', newest first.
+  void destroy_nodes(size_t keep) {
+    while (dtor_nodes.size() > keep) {
+      auto& e = dtor_nodes.back();
+      e.destroy(e.node);
+      dtor_nodes.pop_back();
+    }
+  }
+
   //----------------------------------------
   // If we get partway through a match and then fail for some reason, we must
   // "rewind" our match state back to the start of the failed match. This means
   // we must also throw away any parse nodes that were created during the failed
   // match.
 
-  NodeType* checkpoint() {
-    return top_tail;
+  // Nodes are allocated in LIFO order, so everything created after a
+  // checkpoint is above the allocator's mark and at the end of 'dtor_nodes'.
+  // Rewinding destroys the latter, if there are any, and throws the rest away
+  // by resetting the mark. Bookmarks compare by tail only.
+
+  struct Bookmark {
+    NodeType* tail;
+    LifoAlloc::Mark mark;
+    size_t dtor_count;
+    bool operator==(const Bookmark& b) const { return tail == b.tail; }
+  };
+
+  Bookmark checkpoint() {
+    return {top_tail, alloc.mark(), dtor_nodes.size()};
   }
 
-  void rewind(NodeType* old_tail) {
-    while(top_tail != old_tail) {
-      //printf("rewind!\n");
-      auto dead = top_tail;
-      top_tail = top_tail->node_prev;
-      recycle(dead);
+  void rewind(Bookmark bookmark) {
+    if constexpr (call_destructors) destroy_nodes(bookmark.dtor_count);
+    alloc.rewind(bookmark.mark);
+    top_tail = bookmark.tail;
+    if (top_tail) {
+      top_tail->node_next = nullptr;
+    } else {
+      top_head = nullptr;
     }
   }
 
@@ -321,32 +606,453 @@ struct NodeContext {
   }
 
   //----------------------------------------
-  // Nodes _must_ be deleted in the reverse order they were allocated.
-  // In practice, this means we must delete the "parent" node first and then
-  // must delete the child nodes from tail to head.
 
-  void recycle(NodeType* node) {
-    if (node == nullptr) return;
-    auto tail = node->child_tail;
+  LifoAlloc alloc;
+  std::vector<DtorEntry> dtor_nodes;
+  PreorderTree<NodeType> flat;
+  NodeType* top_head;
+  NodeType* top_tail;
+  int trace_depth;
+  const SpanType::AtomType* _highwater = nullptr;
+};
+
+//------------------------------------------------------------------------------
+// NodeBase spends 72 bytes per node on a tag pointer, a two-pointer span,
+// flags, tag id, size and five links. CompactNodeBase packs the same tree
+// into 24 bytes -
+//
+//   - the match tag is a 16-bit TagTable id,
+//   - the span is a 32-bit offset and length into the context's source,
+//   - prev/next/child_tail links are 32-bit offsets from the node itself.
+//
+// There's no parent link, and a node's first child is found by walking back
+// from its last child.
+
+// Compact nodes live in one array owned by CompactNodeContext, which grows by
+// reallocating - a node pointer is only good until the next node is created,
+// so contexts and captures hold on to node indices instead. Sources have to be
+// smaller than 4 gigs.
 
-    detach(node);
-    if (call_destructors) node->~NodeType();
-    alloc.free(node);
+template<typename NodeType, typename AtomType>
+struct CompactNodeBase {
+  using SpanType = Span<AtomType>;
 
-    while (tail) {
-      auto prev = tail->node_prev;
-      recycle((NodeType*)tail);
-      tail = prev;
+  //----------------------------------------
+
+  NodeType* node_prev()  { return link(prev_ofs); }
+  NodeType* node_next()  { return link(next_ofs); }
+  NodeType* child_tail() { return link(tail_ofs); }
+
+  NodeType* child_head() {
+    auto c = child_tail();
+    if (c) while (c->prev_ofs) c = c->node_prev();
+    return c;
+  }
+
+  template<StringParam name>
+  NodeType* child() {
+    auto id = TagId<name>::get();
+    for (auto c = child_head(); c; c = c->node_next()) {
+      if (c->tag_id == id) return c;
     }
+    return nullptr;
+  }
+
+  const char* match_tag() const {
+    return TagTable::name(tag_id);
+  }
+
+  bool tag_is(const char* name) const {
+    return strcmp(match_tag(), name) == 0;
+  }
+
+  template<StringParam name>
+  bool tag_is() const {
+    return tag_id == TagId<name>::get();
+  }
+
+  size_t node_count() {
+    size_t accum = 1;
+    for (auto c = child_tail(); c; c = c->node_prev()) accum += c->node_count();
+    return accum;
+  }
+
+  NodeType* link(int32_t ofs) {
+    return ofs ? (NodeType*)this + ofs : nullptr;
+  }
+
+  void set_link(int32_t& ofs, NodeType* target) {
+    ofs = target ? int32_t(target - (NodeType*)this) : 0;
   }
 
   //----------------------------------------
 
-  LifoAlloc alloc;
-  NodeType* top_head;
-  NodeType* top_tail;
-  int trace_depth;
-  const SpanType::AtomType* _highwater = nullptr;
+  uint16_t tag_id;
+  uint16_t flags;
+  uint32_t span_begin;
+  uint32_t span_len;
+  int32_t  prev_ofs;
+  int32_t  next_ofs;
+  int32_t  tail_ofs;
+};
+
+//------------------------------------------------------------------------------
+// Same interface and node-list semantics as NodeContext, but node handles are
+// indices into the node array (0 = none). The source must be set with
+// reset(source) before parsing, as spans are stored relative to it.
+
+// Nodes are allocated in the same LIFO order as NodeContext's, which means
+// everything created after a checkpoint comes after the checkpoint's node in
+// the array and rewinding is just truncating the array.
+
+template<typename _NodeType>
+struct CompactNodeContext {
+  using NodeType = _NodeType;
+  using SpanType = typename NodeType::SpanType;
+  using AtomType = typename SpanType::AtomType;
+
+  // Nodes get moved around when the array grows.
+  static_assert(std::is_trivially_copyable_v<NodeType>);
+  static constexpr bool call_constructors = false;
+  static constexpr bool call_destructors  = false;
+
+  CompactNodeContext() {}
+  CompactNodeContext(const CompactNodeContext&) = delete;
+  CompactNodeContext& operator=(const CompactNodeContext&) = delete;
+
+  ~CompactNodeContext() {
+    ::free(nodes);
+  }
+
+  void reset() {
+    node_total = 1;
+    top_head = 0;
+    top_tail = 0;
+  }
+
+  void reset(SpanType new_source) {
+    matcheroni_assert(size_t(new_source.len()) <= UINT32_MAX);
+    reset();
+    source = new_source;
+  }
+
+  //----------------------------------------
+
+  NodeType* node(uint32_t index) {
+    return index ? nodes + index : nullptr;
+  }
+
+  uint32_t index(NodeType* n) {
+    return n ? uint32_t(n - nodes) : 0;
+  }
+
+  SpanType span(const NodeType* n) const {
+    auto begin = source.begin + n->span_begin;
+    return SpanType(begin, begin + n->span_len);
+  }
+
+  size_t node_count() {
+    size_t accum = 0;
+    for (auto c = node(top_head); c; c = c->node_next()) accum += c->node_count();
+    return accum;
+  }
+
+  // Bytes used by the nodes currently in the tree.
+  size_t tree_bytes() const {
+    return (node_total - 1) * sizeof(NodeType);
+  }
+
+  //----------------------------------------
+
+  template<typename node_type, StringParam match_tag>
+  node_type* create_node(SpanType span, uint64_t flags, uint32_t old_tail) {
+    static_assert(std::is_same_v<node_type, NodeType>);
+
+    if (node_total >= node_cap) {
+      node_cap = node_cap ? node_cap * 2 : 4096;
+      nodes = (NodeType*)realloc((void*)nodes, node_cap * sizeof(NodeType));
+    }
+
+    auto new_node = nodes + node_total++;
+    new_node->tag_id = TagId<match_tag>::get();
+    new_node->flags = uint16_t(flags);
+    set_span(new_node, span);
+    merge_node(new_node, old_tail);
+    return new_node;
+  }
+
+  void set_span(NodeType* n, SpanType span) {
+    n->span_begin = uint32_t(span.begin - source.begin);
+    n->span_len = uint32_t(span.end - span.begin);
+  }
+
+  //----------------------------------------
+
+  void append(NodeType* new_node) {
+    new_node->prev_ofs = 0;
+    new_node->next_ofs = 0;
+    new_node->tail_ofs = 0;
+
+    if (top_tail) {
+      auto old_tail = node(top_tail);
+      new_node->set_link(new_node->prev_ofs, old_tail);
+      old_tail->set_link(old_tail->next_ofs, new_node);
+      top_tail = index(new_node);
+    } else {
+      top_head = index(new_node);
+      top_tail = index(new_node);
+    }
+  }
+
+  void detach(NodeType* n) {
+    auto prev = n->node_prev();
+    auto next = n->node_next();
+    if (prev) prev->set_link(prev->next_ofs, next);
+    if (next) next->set_link(next->prev_ofs, prev);
+    if (top_head == index(n)) top_head = index(next);
+    if (top_tail == index(n)) top_tail = index(prev);
+    n->prev_ofs = 0;
+    n->next_ofs = 0;
+  }
+
+  void splice(NodeType* new_node, NodeType* child_head, NodeType* child_tail) {
+    auto prev = child_head->node_prev();
+    auto next = child_tail->node_next();
+
+    new_node->set_link(new_node->prev_ofs, prev);
+    new_node->set_link(new_node->next_ofs, next);
+    new_node->set_link(new_node->tail_ofs, child_tail);
+
+    if (prev) prev->set_link(prev->next_ofs, new_node);
+    if (next) next->set_link(next->prev_ofs, new_node);
+
+    child_head->prev_ofs = 0;
+    child_tail->next_ofs = 0;
+
+    if (top_head == index(child_head)) top_head = index(new_node);
+    if (top_tail == index(child_tail)) top_tail = index(new_node);
+  }
+
+  //----------------------------------------
+
+  uint32_t checkpoint() {
+    return top_tail;
+  }
+
+  void rewind(uint32_t old_tail) {
+    if (top_tail == old_tail) return;
+    node_total = old_tail ? old_tail + 1 : 1;
+    top_tail = old_tail;
+    if (old_tail) {
+      node(old_tail)->next_ofs = 0;
+    } else {
+      top_head = 0;
+    }
+  }
+
+  void merge_node(NodeType* new_node, uint32_t old_tail) {
+    if (old_tail == top_tail) {
+      append(new_node);
+    } else {
+      auto child_head = old_tail ? node(old_tail)->node_next() : node(top_head);
+      splice(new_node, child_head, node(top_tail));
+    }
+  }
+
+  NodeType* enclose_bookmark(uint32_t old_tail, SpanType bounds) {
+    auto first = old_tail ? node(old_tail)->node_next() : node(top_head);
+
+    auto node_b = first;
+    for (; node_b; node_b = node_b->node_next()) {
+      if (node_b->flags & 1) break;
+    }
+    if (node_b == nullptr) return node_b;
+
+    set_span(node_b, bounds);
+    node_b->flags &= ~1;
+
+    if (node_b != first) {
+      auto child_tail = node_b->node_prev();
+      detach(node_b);
+      splice(node_b, first, child_tail);
+    }
+
+    return node_b;
+  }
+
+  //----------------------------------------
+
+  NodeType* nodes = nullptr;
+  uint32_t node_total = 1;  // Slot 0 is never used, index 0 means "no node"
+  uint32_t node_cap = 0;
+  uint32_t top_head = 0;
+  uint32_t top_tail = 0;
+  SpanType source;
+  int trace_depth = 0;
+  const AtomType* _highwater = nullptr;
+};
+
+//------------------------------------------------------------------------------
+// Tape output, for consumers that only stream over captures in document order
+// and don't need a tree. Each capture is a 16-byte TapeRecord in one flat
+// array, in preorder, and a record's 'size' is the number of records in its
+// subtree including itself. A record's children start right after it, and its
+// next sibling starts right after its subtree.
+
+// A capture doesn't know its extent until its pattern matches, so
+// open_capture() reserves its record up front and create_node() fills it in,
+// or close_failed_capture() drops it if the pattern fails. Rewinding truncates
+// the tape, taking any records that were still open with it. Like
+// CompactNodeContext, spans are offsets into the source passed to
+// reset(source).
+
+struct TapeRecord {
+  uint16_t tag_id;
+  uint16_t flags;
+  uint32_t span_begin;
+  uint32_t span_end;
+  uint32_t size;
+
+  const char* match_tag() const {
+    return TagTable::name(tag_id);
+  }
+
+  template<StringParam name>
+  bool tag_is() const {
+    return tag_id == TagId<name>::get();
+  }
+};
+
+// Walks a run of sibling records. next() steps over the current record's
+// subtree, children() walks the records inside it.
+
+struct TapeCursor {
+  const TapeRecord* rec;
+  const TapeRecord* end;
+
+  explicit operator bool() const { return rec < end; }
+  const TapeRecord* operator->() const { return rec; }
+  const TapeRecord& operator*() const { return *rec; }
+
+  void next() { rec += rec->size; }
+  TapeCursor children() const { return {rec + 1, rec + rec->size}; }
+};
+
+template<typename _AtomType>
+struct TapeContext {
+  using NodeType = TapeRecord;
+  using AtomType = _AtomType;
+  using SpanType = Span<AtomType>;
+
+  static constexpr bool call_constructors = false;
+  static constexpr bool call_destructors  = false;
+
+  TapeContext() {}
+  TapeContext(const TapeContext&) = delete;
+  TapeContext& operator=(const TapeContext&) = delete;
+
+  ~TapeContext() {
+    ::free(tape);
+  }
+
+  void reset() {
+    top_tail = 0;
+  }
+
+  void reset(SpanType new_source) {
+    matcheroni_assert(size_t(new_source.len()) <= UINT32_MAX);
+    reset();
+    source = new_source;
+  }
+
+  //----------------------------------------
+
+  TapeCursor top() const {
+    return {tape, tape + top_tail};
+  }
+
+  SpanType span(const TapeRecord* r) const {
+    return SpanType(source.begin + r->span_begin, source.begin + r->span_end);
+  }
+
+  size_t node_count() const {
+    return top_tail;
+  }
+
+  size_t tape_bytes() const {
+    return top_tail * sizeof(TapeRecord);
+  }
+
+  //----------------------------------------
+
+  uint32_t open_capture() {
+    if (top_tail >= tape_cap) {
+      tape_cap = tape_cap ? tape_cap * 2 : 4096;
+      tape = (TapeRecord*)realloc((void*)tape, tape_cap * sizeof(TapeRecord));
+    }
+    return top_tail++;
+  }
+
+  // A failed capture's record never gets filled in, so drop it along with
+  // anything its pattern left after it.
+  void close_failed_capture(uint32_t old_tail) {
+    top_tail = old_tail;
+  }
+
+  // CaptureEnd<> doesn't open a record first, so 'old_tail' can be the end of
+  // the tape.
+  template<typename node_type, StringParam match_tag>
+  TapeRecord* create_node(SpanType span, uint64_t flags, uint32_t old_tail) {
+    static_assert(std::is_same_v<node_type, TapeRecord>);
+    if (old_tail == top_tail) open_capture();
+
+    auto r = tape + old_tail;
+    r->tag_id = TagId<match_tag>::get();
+    r->flags = uint16_t(flags);
+    r->size = top_tail - old_tail;
+    set_span(r, span);
+    return r;
+  }
+
+  void set_span(TapeRecord* r, SpanType span) {
+    r->span_begin = uint32_t(span.begin - source.begin);
+    r->span_end = uint32_t(span.end - source.begin);
+  }
+
+  //----------------------------------------
+
+  uint32_t checkpoint() {
+    return top_tail;
+  }
+
+  void rewind(uint32_t old_tail) {
+    top_tail = old_tail;
+  }
+
+  // The bookmark record is a leaf, so enclosing the records before it means
+  // moving it in front of them.
+  TapeRecord* enclose_bookmark(uint32_t old_tail, SpanType bounds) {
+    auto b = old_tail;
+    while (b < top_tail && !(tape[b].flags & 1)) b += tape[b].size;
+    if (b >= top_tail) return nullptr;
+
+    auto r = tape[b];
+    memmove((void*)(tape + old_tail + 1), tape + old_tail, (b - old_tail) * sizeof(TapeRecord));
+    r.flags &= ~1;
+    r.size = b - old_tail + 1;
+    set_span(&r, bounds);
+    tape[old_tail] = r;
+    return tape + old_tail;
+  }
+
+  //----------------------------------------
+
+  TapeRecord* tape = nullptr;
+  uint32_t top_tail = 0;  // Records in use, including open ones
+  uint32_t tape_cap = 0;
+  SpanType source;
+  int trace_depth = 0;
+  const AtomType* _highwater = nullptr;
 };
 
 //------------------------------------------------------------------------------
@@ -360,22 +1066,26 @@ struct Capture {
 
   template<typename context, typename atom>
   static Span<atom> match(context& ctx, Span<atom> body) {
+    // Contexts that have to reserve something before the pattern runs (see
+    // TapeContext) provide open_capture() and close_failed_capture(). Everyone
+    // else just hands create_node() the tail from before the match.
+    constexpr bool hooked = requires(context& c) { c.open_capture(); };
+
     auto old_tail = ctx.top_tail;
+    if constexpr (hooked) old_tail = ctx.open_capture();
     auto tail = pattern::match(ctx, body);
 
     if (tail.is_valid()) {
       Span<atom> node_span = {body.begin, tail.begin};
-
-      node_type* new_node = (node_type*)ctx.alloc.alloc(sizeof(node_type));
-      if (context::call_constructors) {
-        new (new_node) node_type();
-      }
-      ctx.merge_node(new_node, old_tail);
-      new_node->init(match_tag.str_val, node_span, 0);
+      ctx.template create_node<node_type, match_tag>(node_span, 0, old_tail);
+    } else {
+      if constexpr (hooked) ctx.close_failed_capture(old_tail);
     }
 
     return tail;
   }
+
+  static constexpr FirstSet first_set() { return first_set_of<pattern>(); }
 };
 
 //------------------------------------------------------------------------------
@@ -422,18 +1132,287 @@ struct CaptureEnd {
     auto tail = P::match(ctx, body);
     if (tail.is_valid()) {
       Span<atom> new_span(tail.begin, tail.begin);
+      ctx.template create_node<node_type, match_tag>(new_span, /*flags*/ 1, ctx.top_tail);
+    }
+    return tail;
+
+  }
+};
 
-      node_type* new_node = (node_type*)ctx.alloc.alloc(sizeof(node_type));
-      if (context::call_constructors) {
-        new (new_node) node_type();
+//------------------------------------------------------------------------------
+// Packrat memoization. Oneof<> retries each alternative from scratch, so
+// grammars where several alternatives share a long prefix (declarations vs
+// expressions vs function definitions in C, for example) re-match the same
+// sub-patterns at the same position over and over.
+
+// Memo<tag, P> caches the result of matching P at a given position - where it
+// stopped, or where it failed - along with a copy of the parse nodes it made.
+// A later attempt to match P at the same position replays the cached result
+// instead of re-running P.
+
+// Contexts opt in by deriving from MemoContext<>, which adds a MemoTable.
+// Cached results are only valid as long as whatever external state P depends
+// on (symbol tables and the like) doesn't change, so the context must call
+// memo.invalidate() whenever it does. Matches that change that state
+// themselves are not cached.
+
+// Replayed nodes are bitwise copies of the originals, so the context's node
+// type must be trivially copyable. Matches that keep nodes of a derived type
+// with a destructor aren't cached, as the copies would never be destroyed.
+
+struct MemoTable {
+  struct Entry {
+    const void* rule;        // nullptr = empty slot
+    const void* begin;       // the span P was matched against
+    const void* end;
+    const void* tail_begin;  // nullptr if the match failed
+    const void* tail_end;
+    uint32_t generation;
+    size_t   node_begin;     // cached nodes, as offsets into the node buffer
+    size_t   node_end;
+  };
+
+  // Each cached node is stored as a copy of the node followed by a record of
+  // its size and child count.
+  struct NodeRecord {
+    uint32_t size;
+    uint32_t child_count;
+  };
+
+  MemoTable() {}
+  MemoTable(const MemoTable&) = delete;
+  MemoTable& operator=(const MemoTable&) = delete;
+
+  ~MemoTable() {
+    ::free(slots);
+    ::free(node_buf);
+  }
+
+  void clear() {
+    if (slots) memset(slots, 0, sizeof(Entry) * slot_count);
+    used_count = 0;
+    node_size = 0;
+    generation = 0;
+  }
+
+  // Every cached entry becomes stale. O(1) - stale slots are reused lazily.
+  void invalidate() {
+    generation++;
+    node_size = 0;
+  }
+
+  //----------------------------------------
+
+  static size_t hash(const void* rule, const void* begin) {
+    uint64_t h = uint64_t(uintptr_t(begin)) ^ (uint64_t(uintptr_t(rule)) << 16);
+    h *= 0x9E3779B97F4A7C15ull;
+    return size_t(h ^ (h >> 32));
+  }
+
+  Entry* find(const void* rule, const void* begin, const void* end) {
+    lookups++;
+    if (!slots) return nullptr;
+    size_t mask = slot_count - 1;
+    for (size_t i = hash(rule, begin) & mask;; i = (i + 1) & mask) {
+      Entry& e = slots[i];
+      if (e.rule == nullptr) return nullptr;
+      if (e.rule == rule && e.begin == begin && e.end == end &&
+          e.generation == generation) {
+        return &e;
+      }
+    }
+  }
+
+  Entry* insert(const void* rule, const void* begin, const void* end) {
+    if ((used_count + 1) * 2 > slot_count) rehash();
+    size_t mask = slot_count - 1;
+    for (size_t i = hash(rule, begin) & mask;; i = (i + 1) & mask) {
+      Entry& e = slots[i];
+      if (e.rule == nullptr) {
+        used_count++;
+      } else if (e.generation == generation) {
+        continue;
       }
+      e.rule = rule;
+      e.begin = begin;
+      e.end = end;
+      e.generation = generation;
+      stores++;
+      return &e;
+    }
+  }
+
+  // Drops stale entries, growing the table if it's still more than a quarter
+  // full afterwards.
+  void rehash() {
+    auto old_slots = slots;
+    auto old_count = slot_count;
+
+    size_t live = 0;
+    for (size_t i = 0; i < old_count; i++) {
+      if (old_slots[i].rule && old_slots[i].generation == generation) live++;
+    }
 
-      ctx.merge_node(new_node, ctx.top_tail);
-      new_node->init(match_tag.str_val, new_span, /*flags*/ 1);
-      // if (new_node->span.end > ctx._highwater) ctx._highwater = new_node->span.end;
+    slot_count = old_count ? old_count : 1024;
+    while ((live + 1) * 4 > slot_count) slot_count *= 2;
+    slots = (Entry*)calloc(slot_count, sizeof(Entry));
+    used_count = live;
+
+    size_t mask = slot_count - 1;
+    for (size_t i = 0; i < old_count; i++) {
+      Entry& e = old_slots[i];
+      if (!e.rule || e.generation != generation) continue;
+      size_t j = hash(e.rule, e.begin) & mask;
+      while (slots[j].rule) j = (j + 1) & mask;
+      slots[j] = e;
     }
+    ::free(old_slots);
+  }
+
+  //----------------------------------------
+
+  void push_node(const void* node, size_t size, uint32_t child_count) {
+    size_t need = node_size + size + sizeof(NodeRecord);
+    if (need > node_cap) {
+      node_cap = node_cap ? node_cap * 2 : 65536;
+      while (node_cap < need) node_cap *= 2;
+      node_buf = (char*)realloc(node_buf, node_cap);
+    }
+    memcpy(node_buf + node_size, node, size);
+    auto rec = (NodeRecord*)(node_buf + node_size + size);
+    rec->size = uint32_t(size);
+    rec->child_count = child_count;
+    node_size = need;
+  }
+
+  //----------------------------------------
+
+  Entry*   slots = nullptr;
+  size_t   slot_count = 0;
+  size_t   used_count = 0;
+  uint32_t generation = 0;
+
+  char*    node_buf = nullptr;
+  size_t   node_size = 0;
+  size_t   node_cap = 0;
+
+  bool     enabled = true;
+
+  // Stats
+  size_t lookups = 0;
+  size_t hits = 0;
+  size_t stores = 0;
+  size_t replayed_nodes = 0;
+};
+
+//------------------------------------------------------------------------------
+
+template <typename base>
+struct MemoContext : public base {
+  void reset() {
+    base::reset();
+    memo.clear();
+  }
+
+  MemoTable memo;
+};
+
+//------------------------------------------------------------------------------
+
+template <StringParam tag, typename P>
+struct Memo {
+  // The address of 'name' identifies this rule in the memo table.
+  static constexpr auto name = tag;
+
+  template <typename context, typename atom>
+  static Span<atom> match(context& ctx, Span<atom> body) {
+    // replay() memcpys nodes instead of going through create_node().
+    static_assert(std::is_trivially_copyable_v<typename context::NodeType>,
+                  "Memo<> needs trivially copyable nodes");
+
+    auto& memo = ctx.memo;
+    if (!memo.enabled) return P::match(ctx, body);
+
+    const void* rule = &name;
+    if (auto e = memo.find(rule, body.begin, body.end)) {
+      memo.hits++;
+      if (e->tail_begin == nullptr) {
+        return Span<atom>(nullptr, (const atom*)e->tail_end);
+      }
+      replay(ctx, e->node_begin, e->node_end);
+      return Span<atom>((const atom*)e->tail_begin, (const atom*)e->tail_end);
+    }
+
+    auto generation = memo.generation;
+    auto old_tail = ctx.top_tail;
+    [[maybe_unused]] auto dtor_count = ctx.dtor_nodes.size();
+
+    auto tail = P::match(ctx, body);
+
+    // P changed the state it depends on, so we can't reuse its result.
+    if (memo.generation != generation) return tail;
+
+    // P kept nodes that need destructors. Copies of them wouldn't get
+    // destroyed, so don't cache it.
+    if constexpr (context::call_destructors) {
+      if (tail.is_valid() && ctx.dtor_nodes.size() != dtor_count) return tail;
+    }
+
+    size_t node_begin = memo.node_size;
+    if (tail.is_valid()) record(ctx, old_tail);
+
+    auto e = memo.insert(rule, body.begin, body.end);
+    e->tail_begin = tail.begin;
+    e->tail_end = tail.end;
+    e->node_begin = node_begin;
+    e->node_end = memo.node_size;
     return tail;
+  }
+
+  //----------------------------------------
+  // The nodes P made are the ones after 'old_tail' on the node list and
+  // everything under them. We save them in reverse post-order and replay them
+  // back to front, so each node gets created right after its children.
+
+  template <typename context>
+  static void record(context& ctx, typename context::NodeType* old_tail) {
+    for (auto n = ctx.top_tail; n != old_tail; n = n->node_prev) record_tree(ctx, n);
+  }
 
+  template <typename context>
+  static void record_tree(context& ctx, typename context::NodeType* node) {
+    uint32_t child_count = 0;
+    for (auto c = node->child_head; c; c = c->node_next) child_count++;
+    ctx.memo.push_node(node, node->node_size, child_count);
+    for (auto c = node->child_tail; c; c = c->node_prev) record_tree(ctx, c);
+  }
+
+  template <typename context>
+  static void replay(context& ctx, size_t node_begin, size_t node_end) {
+    using NodeType = typename context::NodeType;
+    auto& memo = ctx.memo;
+
+    auto cursor = memo.node_buf + node_end;
+    while (cursor > memo.node_buf + node_begin) {
+      cursor -= sizeof(MemoTable::NodeRecord);
+      auto rec = (const MemoTable::NodeRecord*)cursor;
+      cursor -= rec->size;
+
+      auto new_node = (NodeType*)ctx.alloc.alloc(rec->size);
+      memcpy((void*)new_node, cursor, rec->size);
+      new_node->node_parent = nullptr;
+
+      if (rec->child_count == 0) {
+        ctx.append(new_node);
+      } else {
+        auto child_head = ctx.top_tail;
+        for (uint32_t j = 1; j < rec->child_count; j++) {
+          child_head = child_head->node_prev;
+        }
+        ctx.splice(new_node, child_head, ctx.top_tail);
+      }
+      memo.replayed_nodes++;
+    }
   }
 };
 
@@ -445,7 +1424,7 @@ struct TextParseNode : public NodeBase<TextParseNode, char> {
 };
 
 struct TextParseContext : public NodeContext<TextParseNode> {
-  static int atom_cmp(char a, int b) { return (unsigned char)a - b; }
+  static constexpr auto& atom_cmp = TextMatchContext::atom_cmp;
 };
 
 //------------------------------------------------------------------------------
@@ -6,13 +6,16 @@
 
 #include "matcheroni/dump.hpp"
 
+#include <fcntl.h>     // for open
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>    // for exit
 #include <string.h>
 #include <string>
+#include <sys/mman.h>  // for mmap, madvise
 #include <sys/stat.h>
 #include <time.h>      // for clock_gettime, CLOCK_PROCESS_CP...
+#include <unistd.h>    // for close
 #include <typeinfo>    // for type_info
 #include <vector>
 
@@ -145,6 +148,22 @@ inline double timestamp_ms() {
   return double(t.tv_sec) * 1e3 + double(t.tv_nsec) * 1e-6;
 }
 
+// timestamp_ms() is process CPU time, which adds up across threads. Use this
+// to time anything multithreaded.
+inline double wallclock_ms() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return double(t.tv_sec) * 1e3 + double(t.tv_nsec) * 1e-6;
+}
+
+// CPU time of the calling thread only, for timing work inside a thread while
+// other threads are busy.
+inline double thread_time_ms() {
+  timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return double(t.tv_sec) * 1e3 + double(t.tv_nsec) * 1e-6;
+}
+
 //------------------------------------------------------------------------------
 
 inline std::string read(const char* path) {
@@ -192,23 +211,294 @@ inline void read(const char* path, char*& text_out, size_t& size_out) {
 }
 
 //------------------------------------------------------------------------------
+// MappedFile maps a file into memory read-only and exposes it as a TextSpan,
+// so large inputs don't get copied into a std::string first. The mapping is
+// released when the MappedFile goes out of scope.
 
-template<typename node_type>
-inline uint64_t hash_tree(const node_type* node, int depth = 0) {
+// Files of 2 megs or more are mapped at a 2 meg boundary so that the kernel
+// can back them with huge pages if it supports that for file mappings.
+
+struct MappedFile {
+  static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+  MappedFile() {}
+  explicit MappedFile(const char* path) { open(path); }
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& b) : data(b.data), size(b.size) {
+    b.data = nullptr;
+    b.size = 0;
+  }
+
+  MappedFile& operator=(MappedFile&& b) {
+    if (this != &b) {
+      close();
+      data = b.data;
+      size = b.size;
+      b.data = nullptr;
+      b.size = 0;
+    }
+    return *this;
+  }
+
+  bool open(const char* path) {
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1) {
+      ::close(fd);
+      return false;
+    }
+    size = statbuf.st_size;
+
+    // mmap() can't map zero bytes, but an empty file is still a valid file.
+    if (size == 0) {
+      ::close(fd);
+      data = "";
+      return true;
+    }
+
+    void* base = nullptr;
+    if (size >= huge_page_size) {
+      // Reserve enough address space to find an aligned spot, then map the
+      // file over it and give back the slack on either side.
+      size_t reserve_size = size + huge_page_size;
+      auto reserve = (char*)mmap(nullptr, reserve_size, PROT_NONE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (reserve != MAP_FAILED) {
+        auto aligned = (char*)((uintptr_t(reserve) + huge_page_size - 1) & ~(huge_page_size - 1));
+        base = mmap(aligned, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (base == MAP_FAILED) {
+          munmap(reserve, reserve_size);
+        } else {
+          auto map_end = aligned + page_round(size);
+          if (aligned > reserve) munmap(reserve, aligned - reserve);
+          if (reserve + reserve_size > map_end) munmap(map_end, reserve + reserve_size - map_end);
+        }
+      }
+    }
+    if (base == nullptr || base == MAP_FAILED) {
+      base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+
+    if (base == MAP_FAILED) {
+      size = 0;
+      return false;
+    }
+
+    madvise(base, size, MADV_SEQUENTIAL);
+    madvise(base, size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (size >= huge_page_size) madvise(base, size, MADV_HUGEPAGE);
+#endif
+
+    data = (const char*)base;
+    return true;
+  }
+
+  void close() {
+    if (data && size) munmap((void*)data, size);
+    data = nullptr;
+    size = 0;
+  }
+
+  bool is_open() const { return data != nullptr; }
+
+  TextSpan span() const {
+    return data ? TextSpan(data, data + size) : TextSpan();
+  }
+
+  static size_t page_round(size_t x) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (x + page - 1) & ~(page - 1);
+  }
+
+  const char* data = nullptr;
+  size_t size = 0;
+};
+
+//------------------------------------------------------------------------------
+// StreamMatcher runs a record pattern over and over across input that arrives
+// in chunks, so inputs don't have to fit in memory. The caller writes input
+// into the buffer (or feed()s it in), then calls next() until it stops
+// returning STREAM_RECORD.
+
+// Patterns only work on contiguous spans, so rather than wrapping around like
+// a ring buffer the unconsumed tail (at most one partial record) is moved back
+// to the front of the buffer before more input is written. Record spans are
+// only valid until the next write.
+
+// A match that stops short of the end of the buffered input is only final if
+// the pattern didn't need to look past it - "lookahead" is how many atoms past
+// the end of a record the pattern may examine before it stops. Records that
+// end closer to the end of the buffer than that, and records that fail to
+// match before the end of the stream, are retried once more input arrives.
+// Failures are only reported at the end of the stream or once a record has
+// grown past max_record bytes, as failure positions alone can't tell us
+// whether more input would have helped.
+
+// The pattern should not have side effects (Dispatch<> etc) as it may be run
+// more than once over the same record. Each retry waits for at least twice as
+// much input as the last attempt, so huge records still match in linear time.
+
+// Usage:
+//
+// StreamMatcher<cookbook::line> stream;
+// while (1) {
+//   TextSpan record;
+//   auto status = stream.next(ctx, record);
+//   if (status == STREAM_RECORD) { ...; continue; }
+//   if (status != STREAM_NEED_INPUT) break;
+//   auto len = ::read(fd, stream.write_begin(), stream.write_room());
+//   if (len > 0) stream.commit(len); else stream.finish();
+// }
+
+enum StreamStatus {
+  STREAM_RECORD,
+  STREAM_NEED_INPUT,
+  STREAM_DONE,
+  STREAM_FAIL,
+};
+
+template <typename pattern, int lookahead = 1>
+struct StreamMatcher {
+  explicit StreamMatcher(size_t chunk_size = 65536, size_t max_record = 1 << 26)
+      : chunk_size(chunk_size), max_record(max_record) {}
+
+  ~StreamMatcher() { free(buf); }
+
+  StreamMatcher(const StreamMatcher&) = delete;
+  StreamMatcher& operator=(const StreamMatcher&) = delete;
+
+  // Where the next chunk of input should be written. Makes room for at least
+  // chunk_size bytes, or as many bytes as are already buffered if that's more.
+  char* write_begin() {
+    size_t live = fill - cursor;
+    size_t want = live > chunk_size ? live : chunk_size;
+    if (cap - fill < want) {
+      memmove(buf, buf + cursor, live);
+      base += cursor;
+      cursor = 0;
+      fill = live;
+    }
+    if (cap - fill < want) {
+      cap = cap * 2 > fill + want ? cap * 2 : fill + want;
+      buf = (char*)realloc(buf, cap);
+    }
+    return buf + fill;
+  }
+
+  size_t write_room() {
+    write_begin();
+    return cap - fill;
+  }
+
+  void commit(size_t len) {
+    matcheroni_assert(fill + len <= cap);
+    fill += len;
+  }
+
+  void feed(TextSpan chunk) {
+    while (chunk.len()) {
+      size_t room = write_room();
+      size_t len = size_t(chunk.len()) < room ? chunk.len() : room;
+      memcpy(buf + fill, chunk.begin, len);
+      commit(len);
+      chunk = chunk.advance(len);
+    }
+  }
+
+  // No more input will arrive, whatever is left must match as-is.
+  void finish() { eof = true; }
+
+  template <typename context>
+  StreamStatus next(context& ctx, TextSpan& record) {
+    if (cursor == fill) return eof ? STREAM_DONE : STREAM_NEED_INPUT;
+    TextSpan body(buf + cursor, buf + fill);
+    if (!eof && size_t(body.len()) < retry_len) return STREAM_NEED_INPUT;
+
+    auto bookmark = ctx.checkpoint();
+    auto tail = pattern::match(ctx, body);
+
+    if (tail.is_valid() && (eof || tail.begin + lookahead <= body.end)) {
+      // A record that consumes nothing would never make progress.
+      if (tail.begin == body.begin) return STREAM_FAIL;
+      record = TextSpan(body.begin, tail.begin);
+      cursor += tail.begin - body.begin;
+      retry_len = 0;
+      return STREAM_RECORD;
+    }
+
+    if (bookmark != ctx.checkpoint()) ctx.rewind(bookmark);
+    if (eof || size_t(body.len()) > max_record) {
+      record = TextSpan(nullptr, tail.is_valid() ? body.end : tail.end);
+      return STREAM_FAIL;
+    }
+    retry_len = body.len() * 2;
+    return STREAM_NEED_INPUT;
+  }
+
+  // Offset of the start of the unconsumed input from the start of the stream.
+  size_t stream_pos() const { return base + cursor; }
+
+  const size_t chunk_size;
+  const size_t max_record;
+
+  char* buf = nullptr;
+  size_t cap = 0;
+  size_t cursor = 0;
+  size_t fill = 0;
+  size_t base = 0;
+  size_t retry_len = 0;
+  bool eof = false;
+};
+
+//------------------------------------------------------------------------------
+
+// Folds one node's tag, depth and text. Split out of hash_node() so contexts
+// that don't keep spans in their nodes can hash them the same way.
+
+inline uint64_t hash_node_text(const char* match_tag, TextSpan text, int depth) {
   uint64_t h = 1 + depth * 0x87654321;
 
-  for (auto c = node->match_tag; *c; c++) {
+  for (auto c = match_tag; *c; c++) {
     h = (h * 975313579) ^ *c;
   }
-
-  for (auto c = node->span.begin; c < node->span.end; c++) {
+  for (auto c = text.begin; c < text.end; c++) {
     h = (h * 123456789) ^ *c;
   }
 
+  return h;
+}
+
+template<typename node_type>
+inline uint64_t hash_node(const node_type* node, int depth) {
+  // Nodes that match tokens instead of text hash the text the tokens cover,
+  // so the hash only depends on the source and the shape of the tree.
+  TextSpan text;
+  if (node->span.begin < node->span.end) {
+    if constexpr (requires { node->as_text_span(); }) {
+      text = node->as_text_span();
+    } else {
+      text = node->span;
+    }
+  }
+  return hash_node_text(node->match_tag, text, depth);
+}
+
+template<typename node_type>
+inline uint64_t hash_tree(const node_type* node, int depth = 0) {
+  uint64_t h = hash_node(node, depth);
   for (auto c = node->child_head; c; c = c->node_next) {
     h = (h * 987654321) ^ hash_tree(c, depth + 1);
   }
-
   return h;
 }
 
@@ -221,6 +511,85 @@ inline uint64_t hash_context(context& ctx) {
   return h;
 }
 
+// The same hash for a compacted PreorderTree, walking it by index instead of
+// through the node links.
+
+template<typename tree_type>
+inline uint64_t hash_flat(const tree_type& tree, uint32_t index, int depth = 0) {
+  uint64_t h = hash_node(tree.nodes + index, depth);
+  for (auto& c : tree.children(index)) {
+    h = (h * 987654321) ^ hash_flat(tree, tree.index(&c), depth + 1);
+  }
+  return h;
+}
+
+template<typename tree_type>
+inline uint64_t hash_flat(const tree_type& tree) {
+  uint64_t h = 123456789;
+  for (auto& root : tree.roots()) {
+    h = (h * 373781549) ^ hash_flat(tree, tree.index(&root));
+  }
+  return h;
+}
+
+// The same hash for a CompactNodeContext, whose nodes keep their spans as
+// offsets into the context's source.
+
+template<typename context, typename node_type>
+inline uint64_t hash_compact(context& ctx, node_type* node, int depth = 0) {
+  uint64_t h = hash_node_text(node->match_tag(), ctx.span(node), depth);
+  for (auto c = node->child_head(); c; c = c->node_next()) {
+    h = (h * 987654321) ^ hash_compact(ctx, c, depth + 1);
+  }
+  return h;
+}
+
+template<typename context>
+inline uint64_t hash_compact(context& ctx) {
+  uint64_t h = 123456789;
+  for (auto node = ctx.node(ctx.top_head); node; node = node->node_next()) {
+    h = (h * 373781549) ^ hash_compact(ctx, node);
+  }
+  return h;
+}
+
+// Folds each node's tag, depth and span length in preorder, without touching
+// the source text, so timing it mostly times the walk itself. Walking the
+// links and visiting a PreorderTree give the same result.
+
+template<typename node_type>
+inline uint64_t shape_key(const node_type& node, int depth) {
+  return (uint64_t(node.tag_id) << 48) ^ (uint64_t(depth) << 32) ^
+         uint64_t(node.span.end - node.span.begin);
+}
+
+template<typename node_type>
+inline uint64_t hash_shape(const node_type* node, uint64_t h, int depth) {
+  h = (h * 373781549) ^ shape_key(*node, depth);
+  for (auto c = node->child_head; c; c = c->node_next) {
+    h = hash_shape(c, h, depth + 1);
+  }
+  return h;
+}
+
+template<typename context>
+inline uint64_t hash_shape(context& ctx) {
+  uint64_t h = 123456789;
+  for (auto node = ctx.top_head; node; node = node->node_next) {
+    h = hash_shape(node, h, 0);
+  }
+  return h;
+}
+
+template<typename tree_type>
+inline uint64_t hash_shape_flat(const tree_type& tree) {
+  uint64_t h = 123456789;
+  tree.visit([&](const auto& node, int depth) {
+    h = (h * 373781549) ^ shape_key(node, depth);
+  });
+  return h;
+}
+
 //------------------------------------------------------------------------------
 
 constexpr uint32_t pack_color(double r, double g, double b) {
@@ -1,6 +1,8 @@
 #include "matcheroni/Matcheroni.hpp"
 #include "matcheroni/Utilities.hpp"
+#include "matcheroni/Cookbook.hpp"
 
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 #include <string>
@@ -190,6 +192,45 @@ void test_lit() {
 
 //------------------------------------------------------------------------------
 
+void test_lits() {
+  TextSpan text;
+  TextSpan tail;
+
+  text = utils::to_span("");
+  tail = Lits<"foo", "bar">::match(ctx, text);
+  TEST(!tail.is_valid() && std::string(tail.end) == "");
+
+  text = utils::to_span("bar baz");
+  tail = Lits<"foo", "bar", "baz">::match(ctx, text);
+  TEST(tail.is_valid() && tail == " baz");
+
+  // Lits<> takes the longest match whatever order the literals are in.
+  text = utils::to_span("<<=1");
+  tail = Lits<"<", "<<", "<<=">::match(ctx, text);
+  TEST(tail.is_valid() && tail == "1");
+  tail = Lits<"<<=", "<", "<<">::match(ctx, text);
+  TEST(tail.is_valid() && tail == "1");
+
+  // A partial match of a longer literal falls back to the shorter one.
+  text = utils::to_span("abcdx");
+  tail = Lits<"abc", "abcdef">::match(ctx, text);
+  TEST(tail.is_valid() && tail == "dx");
+
+  // Failing lits match should report fail loc at first non-matching char.
+  text = utils::to_span("abcd0");
+  tail = Lits<"abcdefgh", "abcde", "xyz">::match(ctx, text);
+  TEST(!tail.is_valid() && std::string(tail.end) == "0");
+
+  // Shared prefixes and empty literals.
+  text = utils::to_span("u8\"");
+  tail = Lits<"u8", "u", "U", "L">::match(ctx, text);
+  TEST(tail.is_valid() && tail == "\"");
+  tail = Lits<"", "x">::match(ctx, text);
+  TEST(tail.is_valid() && tail == "u8\"");
+}
+
+//------------------------------------------------------------------------------
+
 void test_seq() {
   TextSpan text;
   TextSpan tail;
@@ -237,6 +278,45 @@ void test_oneof() {
 
 //------------------------------------------------------------------------------
 
+void test_switch() {
+  TextSpan text;
+  TextSpan tail;
+  int index;
+
+  // FIRST sets of the building blocks.
+  constexpr auto f1 = first_set_of<Seq<Opt<Atom<'-'>>, Range<'0', '9'>>>();
+  static_assert(f1.bytes.test('-') && f1.bytes.test('5') && !f1.bytes.test('a'));
+  static_assert(!f1.nullable);
+  constexpr auto f2 = first_set_of<Any<Lits<"xy", "z">>>();
+  static_assert(f2.bytes.test('x') && f2.bytes.test('z') && f2.nullable);
+  constexpr auto f3 = first_set_of<Not<Atom<'a'>>>();  // Might match anything
+  static_assert(f3.bytes.test('q') && f3.nullable);
+
+  using options = Switch<Lit<"foo">, Lit<"bar">, Lit<"barf">, Opt<Atom<'b'>>>;
+
+  text = utils::to_span("barfly");
+  tail = options::match_index(ctx, text, index);
+  TEST(tail.is_valid() && tail == "fly" && index == 1);
+
+  // Options that can match an empty span get tried in front of anything.
+  text = utils::to_span("quux");
+  tail = options::match_index(ctx, text, index);
+  TEST(tail.is_valid() && tail == "quux" && index == 3);
+
+  // Failing switch<> should leave cursor at the end of the largest partial
+  // sub-match, same as oneof<>.
+  text = utils::to_span("abcd0");
+  tail = Switch<Lit<"abcdefgh">, Lit<"abcde">, Lit<"xyz">>::match_index(ctx, text, index);
+  TEST(!tail.is_valid() && std::string(tail.end) == "0" && index == -1);
+
+  // Empty spans try everything.
+  text = utils::to_span("");
+  tail = options::match(ctx, text);
+  TEST(tail.is_valid() && tail == "");
+}
+
+//------------------------------------------------------------------------------
+
 void test_opt() {
   TextSpan text;
   TextSpan tail;
@@ -583,6 +663,137 @@ void test_charset() {
   TEST(tail.is_valid() && tail == "xxxxbbaa");
 }
 
+//------------------------------------------------------------------------------
+// Any<>, Some<> and Until<> over single-atom classes skip long runs of text in
+// bulk when the context uses TextMatchContext::atom_cmp. This context has its
+// own comparator so it always takes the one-atom-at-a-time path, which gives
+// us something to check the bulk path against.
+
+struct ScalarContext : public TextMatchContext {
+  static int atom_cmp(char a, int b) { return (unsigned char)a - b; }
+};
+
+static_assert(uses_text_atom_cmp<TextMatchContext, char>);
+static_assert(!uses_text_atom_cmp<ScalarContext, char>);
+
+template<typename P>
+bool check_bulk_scan(const std::string& s) {
+  TextMatchContext fast_ctx;
+  ScalarContext slow_ctx;
+  auto text = utils::to_span(s);
+  auto tail_a = P::match(fast_ctx, text);
+  auto tail_b = P::match(slow_ctx, text);
+  return tail_a.begin == tail_b.begin && tail_a.end == tail_b.end;
+}
+
+void test_bulk_scan() {
+  // Runs long enough to cover the 64-byte blocks, single vectors, and the
+  // scalar tail, with the terminating character at every offset.
+  for (int len = 0; len < 200; len++) {
+    std::string s(len, 'a');
+    s += "Z\xC3\xA9" "bbbb";
+
+    TEST((check_bulk_scan<Any<Atom<'a'>>>(s)));
+    TEST((check_bulk_scan<Some<Atom<'a', 'q'>>>(s)));
+    TEST((check_bulk_scan<Any<NotAtom<'Z'>>>(s)));
+    TEST((check_bulk_scan<Some<Range<'a', 'z'>>>(s)));
+    TEST((check_bulk_scan<Any<Range<'0', '9', 'a', 'c'>>>(s)));
+    TEST((check_bulk_scan<Any<NotRange<'A', 'Z'>>>(s)));
+    TEST((check_bulk_scan<Some<Charset<"xyza">>>(s)));
+    TEST((check_bulk_scan<Until<Atom<'Z'>>>(s)));
+    TEST((check_bulk_scan<Until<Range<0x80, 0xFF>>>(s)));
+    TEST((check_bulk_scan<Any<Range<0x20, 0x59, 0x5B, 0x10FFFF>>>(s)));
+    TEST((check_bulk_scan<Any<Atom<'a'>, Atom<'Z'>, Seq<Atom<0xC3>, AnyAtom>>>(s)));
+    TEST((check_bulk_scan<Any<Atom<'a'>, Lit<"Z\xC3">>>(s)));
+  }
+
+  // Atoms outside [0,255] and negative chars never match.
+  std::string high(100, '\xFF');
+  TEST((check_bulk_scan<Any<Atom<-1>>>(high)));
+  TEST((check_bulk_scan<Any<Atom<0x1FF>>>(high)));
+  TEST((check_bulk_scan<Any<Charset<"\xFF">>>(high)));
+  TEST((check_bulk_scan<Any<Range<0x100, 0x200>>>(high)));
+}
+
+//------------------------------------------------------------------------------
+
+static_assert(Range<'a', 'c', 'x', 'z'>::match_byte('b'));
+static_assert(!Range<'a', 'c', 'x', 'z'>::match_byte('m'));
+static_assert(!Charset<"\xC3">::match_byte(0xC3));
+
+void test_byte_tables() {
+  // Every byte value, plus the empty span, through the table and scalar paths.
+  for (int c = -1; c < 256; c++) {
+    std::string s;
+    if (c >= 0) s += char(c);
+    s += "\xC3\xA9";
+
+    TEST((check_bulk_scan<Atom<'a', 'b', '\xC3', 0xC3>>(s)));
+    TEST((check_bulk_scan<NotAtom<'a', 'b', 0xFF>>(s)));
+    TEST((check_bulk_scan<Range<'0', '9', 'a', 'f', 0x80, 0xBF>>(s)));
+    TEST((check_bulk_scan<NotRange<'0', '9', 'a', 'f'>>(s)));
+    TEST((check_bulk_scan<Charset<"abc\xC3\n">>(s)));
+    TEST((check_bulk_scan<Oneof<Atom<'x'>, Range<'0', '9'>>>(s)));
+    TEST((check_bulk_scan<Oneof<Range<'a', 'z'>, Atom<'_'>, Lit<"\xC3\xA9">, Range<0xC3, 0xFF>>>(s)));
+    TEST((check_bulk_scan<Some<Oneof<Charset<"abc">, NotAtom<'z'>>>>(s)));
+  }
+}
+
+//------------------------------------------------------------------------------
+// Streams 'text' through a StreamMatcher in chunks of 'chunk' bytes and joins
+// the records with '|'.
+
+template<typename pattern, int lookahead>
+std::string stream_records(const std::string& text, int chunk, utils::StreamStatus& status) {
+  utils::StreamMatcher<pattern, lookahead> stream(chunk);
+  std::string result;
+  size_t pos = 0;
+  while (1) {
+    TextSpan record;
+    status = stream.next(ctx, record);
+    if (status == utils::STREAM_RECORD) {
+      if (result.size()) result += '|';
+      result.append(record.begin, record.end);
+      continue;
+    }
+    if (status != utils::STREAM_NEED_INPUT) break;
+    if (pos == text.size()) {
+      stream.finish();
+    } else {
+      size_t len = std::min(size_t(chunk), text.size() - pos);
+      stream.feed(TextSpan(text.data() + pos, text.data() + pos + len));
+      pos += len;
+    }
+  }
+  return result;
+}
+
+void test_stream() {
+  utils::StreamStatus status;
+  std::string lines = "first line\n\nthird\na much longer fourth line that spans chunks\nlast";
+  std::string joined = "first line\n|\n|third\n|a much longer fourth line that spans chunks\n|last";
+
+  // Every chunk size gives the same records as matching the whole thing.
+  for (int chunk = 1; chunk < 70; chunk++) {
+    TEST((stream_records<cookbook::line, 1>(lines, chunk, status) == joined), "chunk %d", chunk);
+    TEST(status == utils::STREAM_DONE);
+  }
+
+  // "1.5" split after "1." must not turn into the record "1" - the fraction
+  // and exponent need up to three atoms of lookahead to reject.
+  using number = Seq<Opt<Atom<' '>>, cookbook::decimal_float>;
+  for (int chunk = 1; chunk < 8; chunk++) {
+    TEST((stream_records<number, 3>("1.5 22e+7 3", chunk, status) == "1.5| 22e+7| 3"), "chunk %d", chunk);
+    TEST(status == utils::STREAM_DONE);
+  }
+
+  // Records that can't match fail once the stream ends, not before.
+  for (int chunk = 1; chunk < 8; chunk++) {
+    TEST((stream_records<number, 3>("12 34 x5", chunk, status) == "12| 34"), "chunk %d", chunk);
+    TEST(status == utils::STREAM_FAIL);
+  }
+}
+
 //------------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
@@ -593,8 +804,10 @@ int main(int argc, char** argv) {
   test_notatom();
   test_range();
   test_lit();
+  test_lits();
   test_seq();
   test_oneof();
+  test_switch();
   test_opt();
   test_any();
   test_some();
@@ -609,6 +822,9 @@ int main(int argc, char** argv) {
   test_delimited_list();
   test_eol();
   test_charset();
+  test_bulk_scan();
+  test_byte_tables();
+  test_stream();
 
   if (!fail_count) {
     printf("All tests pass!\n");
@@ -2,6 +2,7 @@
 #include "matcheroni/Parseroni.hpp"
 #include "matcheroni/Utilities.hpp"
 
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <string>
@@ -9,6 +10,11 @@
 using namespace matcheroni;
 using namespace parseroni;
 
+// Compares a span's text against a string literal.
+inline bool operator==(TextSpan a, const char* b) {
+  return a.is_valid() && strcmp_span(a, b) == 0;
+}
+
 //------------------------------------------------------------------------------
 
 struct TestNode : public NodeBase<TestNode, char>, public utils::InstanceCounter<TestNode> {
@@ -22,9 +28,9 @@ struct TestContext : public NodeContext<TestNode> {
 //------------------------------------------------------------------------------
 
 void sexp_to_string(TestNode* n, std::string& out) {
-  if (strcmp(n->match_tag, "atom") == 0) {
+  if (n->tag_is<"atom">()) {
     for (auto c = n->span.begin; c < n->span.end; c++) out.push_back(*c);
-  } else if (strcmp(n->match_tag, "list") == 0) {
+  } else if (n->tag_is<"list">()) {
     out.push_back('(');
     for (auto c = n->child_head; c; c = c->node_next) {
       sexp_to_string((TestNode*)c, out);
@@ -43,7 +49,7 @@ void check_hash(context& ctx, uint64_t hash_a) {
   uint64_t hash_b = utils::hash_context(ctx);
   printf("Expected hash 0x%016lx\n", hash_a);
   printf("Actual hash   0x%016lx\n", hash_b);
-  matcheroni_assert(hash_a == hash_b && "bad hash");
+  assert(hash_a == hash_b && "bad hash");
 }
 
 //----------------------------------------
@@ -57,11 +63,12 @@ void reset_everything() {
 //------------------------------------------------------------------------------
 // A mini s-expression parser in ~10 lines of code. :D
 
+template<typename context = TestContext, typename node_type = TestNode>
 struct SExpression {
-  static TextSpan match(TestContext& ctx, TextSpan body) {
+  static TextSpan match(context& ctx, TextSpan body) {
     return Oneof<
-      Capture<"atom", atom, TestNode>,
-      Capture<"list", list, TestNode>
+      Capture<"atom", atom, node_type>,
+      Capture<"list", list, node_type>
     >::match(ctx, body);
   }
 
@@ -86,7 +93,7 @@ void test_basic() {
     TestContext ctx;
     ctx.reset();
     auto text = utils::to_span(expression);
-    auto tail = SExpression::match(ctx, text);
+    auto tail = SExpression<>::match(ctx, text);
     matcheroni_assert(tail.is_valid() && tail == "");
 
     utils::print_summary(ctx, text, tail, 50);
@@ -113,17 +120,17 @@ void test_basic() {
 
   ctx.reset();
   span = utils::to_span("((((a))))");
-  tail = SExpression::match(ctx, span);
+  tail = SExpression<>::match(ctx, span);
   matcheroni_assert(tail.is_valid() && tail == "");
 
   ctx.reset();
   span = utils::to_span("(((())))");
-  tail = SExpression::match(ctx, span);
+  tail = SExpression<>::match(ctx, span);
   matcheroni_assert(tail.is_valid() && tail == "");
 
   ctx.reset();
   span = utils::to_span("(((()))(");
-  tail = SExpression::match(ctx, span);
+  tail = SExpression<>::match(ctx, span);
   matcheroni_assert(!tail.is_valid() && std::string(tail.end) == "(");
 
   printf("test_basic() end\n\n");
@@ -131,6 +138,34 @@ void test_basic() {
 
 //------------------------------------------------------------------------------
 
+void test_tag_ids() {
+  printf("test_tag_ids()\n");
+  reset_everything();
+
+  TestContext ctx;
+  auto text = utils::to_span("(ab,(c),de)");
+  auto tail = SExpression<>::match(ctx, text);
+  assert(tail.is_valid() && tail == "");
+
+  // Captures in different patterns share ids if their tags match.
+  auto root = ctx.top_head;
+  assert(root->tag_id == TagId<"list">::get());
+  assert(root->tag_is<"list">() && !root->tag_is<"atom">());
+  assert(strcmp(TagTable::name(root->tag_id), "list") == 0);
+
+  // child<>() finds the first child with the tag.
+  auto atom = root->child<"atom">();
+  auto list = root->child<"list">();
+  assert(atom && atom->span == "ab");
+  assert(list && list->child<"atom">()->span == "c");
+  assert(root->child<"missing">() == nullptr);
+  assert(atom->tag_is("atom") && atom->tag_is<"atom">());
+
+  printf("test_tag_ids() end\n\n");
+}
+
+//------------------------------------------------------------------------------
+
 void test_rewind() {
   printf("test_rewind()\n");
   reset_everything();
@@ -164,13 +199,133 @@ void test_rewind() {
 }
 
 //------------------------------------------------------------------------------
+// Without destructors, rewinding resets the allocator to the checkpoint's mark
+// instead of freeing nodes one by one. The failed branch here makes enough
+// nodes to spill into a second slab.
 
+struct BulkNode : public NodeBase<BulkNode, char> {
+  TextSpan as_text_span() const { return span; }
+};
+
+struct BulkContext : public NodeContext<BulkNode, true, false> {
+  static int atom_cmp(char a, int b) { return (unsigned char)a - b; }
+};
+
+void test_bulk_rewind() {
+  printf("test_bulk_rewind()\n");
+
+  using pattern =
+  Oneof<
+    Seq<Any<Capture<"a", Atom<'a'>, BulkNode>>, Atom<'b'>>,
+    Capture<"all", Seq<Some<Atom<'a'>>, Atom<'c'>>, BulkNode>
+  >;
+
+  std::string source(40000, 'a');
+  source.push_back('c');
+  auto text = utils::to_span(source);
+
+  BulkContext ctx;
+  for (int rep = 0; rep < 2; rep++) {
+    ctx.reset();
+    auto tail = pattern::match(ctx, text);
+    assert(tail.is_valid() && tail.is_empty());
+    assert(ctx.node_count() == 1);
+    assert(ctx.top_head->tag_is<"all">());
+    assert(ctx.alloc.top_slab->prev == nullptr);
+    assert(ctx.alloc.top_slab->next != nullptr);
+    assert(ctx.alloc.current_size() == sizeof(BulkNode));
+  }
+
+  printf("test_bulk_rewind() end\n\n");
+}
+
+//------------------------------------------------------------------------------
+// compact() moves the tree into one preorder array and frees the allocator.
+// The links, the index walk and the visitor should all see the same tree.
+
+void test_compact() {
+  printf("test_compact()\n");
+
+  BulkContext ctx;
+  auto text = utils::to_span("(abcd,efgh,(ab),(a,(bc,de)),ghijk)");
+  auto tail = SExpression<BulkContext, BulkNode>::match(ctx, text);
+  assert(tail.is_valid() && tail == "");
+
+  auto hash = utils::hash_context(ctx);
+  auto count = ctx.node_count();
+  bool ok = ctx.compact();
+  assert(ok);
+
+  assert(ctx.alloc.current_size() == 0);
+  assert(ctx.flat.count == count);
+  assert(ctx.top_head == ctx.flat.nodes);
+  assert(utils::hash_context(ctx) == hash);
+  assert(utils::hash_flat(ctx.flat) == hash);
+
+  // The root's children are the five list items, the fourth has two.
+  auto& flat = ctx.flat;
+  int children = 0;
+  for (auto& c : flat.children(0)) {
+    children++;
+    if (children == 4) {
+      assert(c.span == "(a,(bc,de))");
+      auto i = flat.index(&c);
+      assert(flat.links[i].subtree_end == i + 5);
+    }
+  }
+  assert(children == 5);
+
+  std::string atoms;
+  int max_depth = 0;
+  flat.visit([&](BulkNode& n, int depth) {
+    if (n.tag_is<"atom">()) atoms.append(n.span.begin, n.span.end);
+    if (depth > max_depth) max_depth = depth;
+  });
+  assert(atoms == "abcdefghababcdeghijk");
+  assert(max_depth == 3);
+
+  printf("test_compact() end\n\n");
+}
+
+//------------------------------------------------------------------------------
+// CompactNodeContext builds the same tree out of 24-byte nodes that keep their
+// spans as offsets, so it should hash the same as the pointer tree.
+
+struct TestCompactNode : public CompactNodeBase<TestCompactNode, char> {};
+
+struct TestCompactContext : public CompactNodeContext<TestCompactNode> {
+  static int atom_cmp(char a, int b) { return (unsigned char)a - b; }
+};
+
+void test_compact_nodes() {
+  printf("test_compact_nodes()\n");
+  reset_everything();
+
+  auto text = utils::to_span("(abcd,efgh,(ab),(a,(bc,de)),ghijk)");
+
+  TestContext tree;
+  auto tree_tail = SExpression<>::match(tree, text);
+  assert(tree_tail.is_valid() && tree_tail == "");
+
+  TestCompactContext compact;
+  compact.reset(text);
+  auto compact_tail = SExpression<TestCompactContext, TestCompactNode>::match(compact, text);
+  assert(compact_tail.is_valid() && compact_tail == "");
+
+  assert(utils::hash_compact(compact) == utils::hash_context(tree));
+
+  printf("test_compact_nodes() end\n\n");
+}
+
+//------------------------------------------------------------------------------
+
+template<typename context = TestContext, typename node_type = TestNode>
 struct BeginEndTest {
 
-  static TextSpan match(TestContext& ctx, TextSpan body) {
+  static TextSpan match(context& ctx, TextSpan body) {
     return Oneof<
-      suffixed<Capture<"atom", atom, TestNode>>,
-      suffixed<Capture<"list", list, TestNode>>
+      suffixed<Capture<"atom", atom, node_type>>,
+      suffixed<Capture<"list", list, node_type>>
     >::match(ctx, body);
   }
 
@@ -179,12 +334,12 @@ struct BeginEndTest {
   template<typename P>
   using suffixed =
   CaptureBegin<
-    TestNode,
+    node_type,
     P,
     Opt<
-      CaptureEnd<"plus", Atom<'+'>, TestNode>,
-      CaptureEnd<"star", Atom<'*'>, TestNode>,
-      CaptureEnd<"opt",  Atom<'?'>, TestNode>
+      CaptureEnd<"plus", Atom<'+'>, node_type>,
+      CaptureEnd<"star", Atom<'*'>, node_type>,
+      CaptureEnd<"opt",  Atom<'?'>, node_type>
     >
   >;
 
@@ -204,7 +359,7 @@ void test_begin_end() {
   TestContext ctx;
 
   auto text = utils::to_span("[ [abc,ab?,cdb+] , [a,b,c*,d,e,f] ]");
-  auto tail = BeginEndTest::match(ctx, text);
+  auto tail = BeginEndTest<>::match(ctx, text);
 
   utils::print_summary(ctx, text, tail, 50);
   check_hash(ctx, 0x401403cbefc2cba9);
@@ -215,6 +370,86 @@ void test_begin_end() {
   printf("test_begin_end() end\n\n");
 }
 
+//------------------------------------------------------------------------------
+// The s-expression and begin/end grammars again, onto a tape. The tape should
+// hold the same captures as the tree, in preorder.
+
+struct TestTapeContext : public TapeContext<char> {
+  static int atom_cmp(char a, int b) { return (unsigned char)a - b; }
+};
+
+bool same_captures(TestTapeContext& tape, TapeCursor c, TestNode* n) {
+  for (; c && n; c.next(), n = n->node_next) {
+    auto span = tape.span(c.rec);
+    if (c->tag_id != n->tag_id) return false;
+    if (span.begin != n->span.begin || span.end != n->span.end) return false;
+    if (!same_captures(tape, c.children(), n->child_head)) return false;
+  }
+  return !c && !n;
+}
+
+template<typename tree_grammar, typename tape_grammar>
+void check_tape(const char* source) {
+  auto text = utils::to_span(source);
+
+  TestContext tree;
+  auto tree_tail = tree_grammar::match(tree, text);
+
+  TestTapeContext tape;
+  tape.reset(text);
+  auto tape_tail = tape_grammar::match(tape, text);
+
+  assert(tree_tail.is_valid() && tree_tail == "");
+  assert(tape_tail.is_valid() && tape_tail == "");
+  assert(tape.node_count() == tree.node_count());
+  assert(same_captures(tape, tape.top(), tree.top_head));
+}
+
+void test_tape() {
+  printf("test_tape()\n");
+  reset_everything();
+
+  check_tape<SExpression<>, SExpression<TestTapeContext, TapeRecord>>(
+    "(abcd,efgh,(ab),(a,(bc,de)),ghijk)");
+  check_tape<BeginEndTest<>, BeginEndTest<TestTapeContext, TapeRecord>>(
+    "[ [abc,ab?,cdb+] , [a,b,c*,d,e,f] ]");
+
+  // Walking the tape directly - skipping over a subtree lands on its sibling.
+  TestTapeContext tape;
+  auto text = utils::to_span("(ab,(c),de)");
+  tape.reset(text);
+  SExpression<TestTapeContext, TapeRecord>::match(tape, text);
+
+  auto root = tape.top();
+  assert(root->tag_is<"list">() && root->size == 5);
+
+  auto c = root.children();
+  assert(c->tag_is<"atom">() && tape.span(c.rec) == "ab");
+  c.next();
+  assert(c->tag_is<"list">() && c->size == 2);
+  c.next();
+  assert(c->tag_is<"atom">() && tape.span(c.rec) == "de");
+  c.next();
+  assert(!c);
+
+  // A capture whose pattern fails drops its record, whether or not anything
+  // rewinds after it.
+  using until_a = Seq<Until<Capture<"a", Atom<'a'>, TapeRecord>>, Atom<'a'>>;
+  text = utils::to_span("bbba");
+  tape.reset(text);
+  auto tail = until_a::match(tape, text);
+  assert(tail.is_valid() && tail == "");
+  assert(tape.node_count() == 0);
+
+  text = utils::to_span("b");
+  tape.reset(text);
+  tail = Capture<"a", Atom<'a'>, TapeRecord>::match(tape, text);
+  assert(!tail.is_valid());
+  assert(tape.node_count() == 0);
+
+  printf("test_tape() end\n\n");
+}
+
 //------------------------------------------------------------------------------
 // This matcher matches nested square brackets with a single letter in the
 // middle, but it does so in a pathologically-horrible way that requires
@@ -270,6 +505,93 @@ void test_pathological() {
   printf("test_pathological() end\n\n");
 }
 
+//------------------------------------------------------------------------------
+// The same pathological matcher, but memoized. Each nested bracket only gets
+// matched once, the other alternatives replay the cached result.
+
+// Replayed nodes are memcpy'd, so this uses the trivially copyable BulkNode.
+
+struct MemoTestContext : public MemoContext<BulkContext> {};
+
+struct MemoPathological {
+  static TextSpan match(MemoTestContext& ctx, TextSpan body) {
+    return Memo<"pathological", pattern>::match(ctx, body);
+  }
+
+  using pattern =
+  Oneof<
+    Capture<"plus",  Seq<Atom<'['>, Ref<match>, Atom<']'>, Atom<'+'>>, BulkNode>,
+    Capture<"minus", Seq<Atom<'['>, Ref<match>, Atom<']'>, Atom<'-'>>, BulkNode>,
+    Capture<"star",  Seq<Atom<'['>, Ref<match>, Atom<']'>, Atom<'*'>>, BulkNode>,
+    Capture<"slash", Seq<Atom<'['>, Ref<match>, Atom<']'>, Atom<'/'>>, BulkNode>,
+    Capture<"opt",   Seq<Atom<'['>, Ref<match>, Atom<']'>, Atom<'?'>>, BulkNode>,
+    Capture<"eq",    Seq<Atom<'['>, Ref<match>, Atom<']'>, Atom<'='>>, BulkNode>,
+    Capture<"none",  Seq<Atom<'['>, Ref<match>, Atom<']'>>, BulkNode>,
+    Capture<"atom",  Range<'a','z'>, BulkNode>
+  >;
+};
+
+//----------------------------------------
+
+void test_memo() {
+  printf("test_memo()\n");
+  reset_everything();
+
+  MemoTestContext ctx;
+
+  auto text = utils::to_span("[[[[[[a]]]]]]");
+  auto tail = MemoPathological::match(ctx, text);
+  assert(tail.is_valid() && "memoized tree invalid");
+
+  // Same tree as test_pathological().
+  utils::print_summary(ctx, text, tail, 50);
+  check_hash(ctx, 0x07a37a832d506209);
+
+  printf("Memo lookups %ld, hits %ld, replayed nodes %ld\n",
+         ctx.memo.lookups, ctx.memo.hits, ctx.memo.replayed_nodes);
+  assert(ctx.memo.stores == 7);
+  assert(ctx.memo.hits == 36);
+
+  // Failed matches are cached too.
+  ctx.reset();
+  text = utils::to_span("[[[[[[a]]]]]");
+  tail = MemoPathological::match(ctx, text);
+  assert(!tail.is_valid());
+
+  printf("test_memo() end\n\n");
+}
+
+//----------------------------------------
+// Nodes of a derived type with a destructor can't be replayed, since the
+// copies would never be destroyed. Matches that keep them don't get cached,
+// so the second alternative runs the capture again.
+
+struct CountedNode : public BulkNode, public utils::InstanceCounter<CountedNode> {};
+
+struct MemoDtorContext : public MemoContext<NodeContext<BulkNode, true, true>> {
+  static int atom_cmp(char a, int b) { return (unsigned char)a - b; }
+};
+
+void test_memo_dtors() {
+  printf("test_memo_dtors()\n");
+  CountedNode::reset_count();
+
+  using counted = Memo<"counted", Capture<"a", Atom<'a'>, CountedNode>>;
+  using pattern = Oneof<Seq<counted, Atom<'b'>>, Seq<counted, Atom<'c'>>>;
+
+  MemoDtorContext ctx;
+  auto text = utils::to_span("ac");
+  auto tail = pattern::match(ctx, text);
+  assert(tail.is_valid() && tail == "");
+  assert(ctx.memo.stores == 0 && ctx.memo.hits == 0);
+  assert(CountedNode::live == 1 && CountedNode::dead == 1);
+
+  ctx.reset();
+  assert(CountedNode::live == 0 && CountedNode::dead == 2);
+
+  printf("test_memo_dtors() end\n\n");
+}
+
 //------------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
@@ -278,12 +600,26 @@ int main(int argc, char** argv) {
   printf("//----------------------------------------\n");
   test_basic();
   printf("//----------------------------------------\n");
+  test_tag_ids();
+  printf("//----------------------------------------\n");
   test_rewind();
   printf("//----------------------------------------\n");
+  test_bulk_rewind();
+  printf("//----------------------------------------\n");
+  test_compact();
+  printf("//----------------------------------------\n");
+  test_compact_nodes();
+  printf("//----------------------------------------\n");
   test_begin_end();
   printf("//----------------------------------------\n");
+  test_tape();
+  printf("//----------------------------------------\n");
   test_pathological();
   printf("//----------------------------------------\n");
+  test_memo();
+  printf("//----------------------------------------\n");
+  test_memo_dtors();
+  printf("//----------------------------------------\n");
 
   printf("All tests pass!\n");
   return 0;